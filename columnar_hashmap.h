@@ -0,0 +1,340 @@
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// Where `ColumnarHashMap` keeps values relative to their keys.
+enum class ValueLayout {
+  // Values in their own array: chain walks touch only keys and links.
+  kSeparate,
+  // Values next to their keys: a hit reads one entry. For small values.
+  kInline,
+};
+
+/**
+ * A chained hash map with index-linked chains over dense arrays, for
+ * lookup-heavy tables with large values.
+ *
+ * Entries live densely in `slots` (key + 32-bit next index) and `values`,
+ * which share positions. Bucket heads and chain links are indices rather
+ * than pointers, so walking a chain touches only the packed key/next slots;
+ * the value array is read only on a hit. There is no per-entry allocation.
+ * With `ValueLayout::kInline` each slot holds its value too (see
+ * `CompactHashMap`).
+ *
+ * Unlike `HashMap`, entries do not stay put: `erase` moves the last entry
+ * into the hole, so a reference from `at` lasts only until the next `insert`
+ * or `erase`, and `begin`/`next` visit entries in storage order. Holds at
+ * most 2^32 - 1 mappings.
+ */
+template <typename KeyT, typename ValT,
+          ValueLayout Layout = ValueLayout::kSeparate>
+class ColumnarHashMap {
+ private:
+  static constexpr uint32_t kNone = UINT32_MAX;
+  static constexpr bool kInline = Layout == ValueLayout::kInline;
+
+  struct KeySlot {
+    KeyT key;
+    uint32_t next;
+  };
+
+  struct InlineSlot {
+    KeyT key;
+    ValT value;
+    uint32_t next;
+  };
+
+  using Slot = conditional_t<kInline, InlineSlot, KeySlot>;
+
+  vector<uint32_t> heads;
+  vector<Slot> slots;
+  // Parallel to `slots`; unused with the inline layout.
+  vector<ValT> values;
+
+  // Utility member for begin/next
+  size_t curr_idx;
+
+  // Helper functions
+
+  size_t bucketIndex(const KeyT& key) const {
+    return std::hash<KeyT>()(key) % heads.size();
+  }
+
+  ValT& valueAt(uint32_t i) {
+    if constexpr (kInline) {
+      return slots[i].value;
+    } else {
+      return values[i];
+    }
+  }
+
+  const ValT& valueAt(uint32_t i) const {
+    if constexpr (kInline) {
+      return slots[i].value;
+    } else {
+      return values[i];
+    }
+  }
+
+  void pushEntry(const KeyT& key, const ValT& value, uint32_t next) {
+    if constexpr (kInline) {
+      slots.push_back({key, value, next});
+    } else {
+      slots.push_back({key, next});
+      try {
+        values.push_back(value);
+      } catch (...) {
+        slots.pop_back();
+        throw;
+      }
+    }
+  }
+
+  // Moves entry `from` into position `to`, leaving links untouched.
+  void moveEntry(uint32_t from, uint32_t to) {
+    slots[to] = std::move(slots[from]);
+    if constexpr (!kInline) {
+      values[to] = std::move(values[from]);
+    }
+  }
+
+  void popEntry() {
+    slots.pop_back();
+    if constexpr (!kInline) {
+      values.pop_back();
+    }
+  }
+
+  // Relinks every entry into `newCapacity` buckets. Keys and values stay
+  // where they are; only heads and next indices are rewritten.
+  void rehash(size_t newCapacity) {
+    if (newCapacity == 0) {
+      newCapacity = 1;
+    }
+    heads.assign(newCapacity, kNone);
+    for (uint32_t i = 0; i < slots.size(); i++) {
+      size_t idx = bucketIndex(slots[i].key);
+      slots[i].next = heads[idx];
+      heads[idx] = i;
+    }
+  }
+
+  // Returns the position of `key` in bucket `idx`, or kNone.
+  uint32_t find(const KeyT& key, size_t idx) const {
+    uint32_t i = heads[idx];
+    while (i != kNone && !(slots[i].key == key)) {
+      i = slots[i].next;
+    }
+    return i;
+  }
+
+  // Returns the link (bucket head or a next field) that points at entry `i`.
+  uint32_t* linkTo(uint32_t i) {
+    uint32_t* link = &heads[bucketIndex(slots[i].key)];
+    while (*link != i) {
+      link = &slots[*link].next;
+    }
+    return link;
+  }
+
+ public:
+  /**
+   * Creates an empty map with 10 buckets.
+   */
+  ColumnarHashMap() : ColumnarHashMap(10) {
+  }
+
+  /**
+   * Creates an empty map with `capacity` buckets.
+   */
+  explicit ColumnarHashMap(size_t capacity)
+      : heads(capacity == 0 ? 1 : capacity, kNone), curr_idx(0) {
+  }
+
+  /**
+   * Checks if the map is empty. Runs in O(1).
+   */
+  bool empty() const {
+    return slots.empty();
+  }
+
+  /**
+   * Returns the number of mappings. Runs in O(1).
+   */
+  size_t size() const {
+    return slots.size();
+  }
+
+  /**
+   * Returns the number of buckets.
+   */
+  size_t get_capacity() const {
+    return heads.size();
+  }
+
+  /**
+   * Returns the bytes held by the bucket, slot and value arrays.
+   */
+  size_t memory_bytes() const {
+    return heads.capacity() * sizeof(uint32_t) +
+           slots.capacity() * sizeof(Slot) + values.capacity() * sizeof(ValT);
+  }
+
+  /**
+   * Sizes the table for `count` mappings: grows the bucket array as
+   * `insert` would and reserves the entries exactly, so loading a known
+   * number of mappings neither resizes nor over-allocates.
+   *
+   * Throws `length_error` if `count` exceeds 2^32 - 1.
+   *
+   * Runs in O(N+B).
+   */
+  void reserve(size_t count) {
+    if (count > kNone) {
+      throw length_error("ColumnarHashMap is limited to 2^32 - 1 entries");
+    }
+    size_t newCapacity = heads.size();
+    while (2 * count > 3 * newCapacity) {  // load factor > 1.5
+      newCapacity *= 2;
+    }
+    if (newCapacity != heads.size()) {
+      rehash(newCapacity);
+    }
+    slots.reserve(count);
+    if constexpr (!kInline) {
+      values.reserve(count);
+    }
+  }
+
+  /**
+   * Adds the mapping `{key -> value}`. If the key already exists, does not
+   * update the mapping. Resizes by doubling when the load factor exceeds 1.5;
+   * a resize relinks indices but never moves keys or values.
+   *
+   * Throws `length_error` if the map already holds 2^32 - 1 mappings.
+   *
+   * Runs in amortized O(L), where L is the length of the longest chain.
+   */
+  void insert(const KeyT& key, const ValT& value) {
+    if (2 * (slots.size() + 1) > 3 * heads.size()) {  // load factor > 1.5
+      rehash(heads.size() * 2);
+    }
+
+    size_t idx = bucketIndex(key);
+    if (find(key, idx) != kNone) {
+      return;
+    }
+    if (slots.size() >= kNone) {
+      throw length_error("ColumnarHashMap is limited to 2^32 - 1 entries");
+    }
+
+    pushEntry(key, value, heads[idx]);
+    heads[idx] = static_cast<uint32_t>(slots.size() - 1);
+  }
+
+  /**
+   * Returns a reference to the value stored for `key`. The reference is
+   * invalidated by the next `insert` or `erase`.
+   *
+   * If key is not present in the map, throw `out_of_range` exception.
+   *
+   * Runs in O(L), touching only keys until the match.
+   */
+  ValT& at(const KeyT& key) {
+    uint32_t i = find(key, bucketIndex(key));
+    if (i == kNone) {
+      throw out_of_range("Key not found");
+    }
+    return valueAt(i);
+  }
+
+  const ValT& at(const KeyT& key) const {
+    uint32_t i = find(key, bucketIndex(key));
+    if (i == kNone) {
+      throw out_of_range("Key not found");
+    }
+    return valueAt(i);
+  }
+
+  /**
+   * Returns `true` if the key is present. Never reads a separate value.
+   *
+   * Runs in O(L), where L is the length of the longest chain.
+   */
+  bool contains(const KeyT& key) const {
+    return find(key, bucketIndex(key)) != kNone;
+  }
+
+  /**
+   * Removes the mapping for `key` and returns its value. The last entry is
+   * moved into the freed position to keep the arrays dense.
+   *
+   * Throws `out_of_range` if the key is not present in the map.
+   *
+   * Runs in O(L), where L is the length of the longest chain.
+   */
+  ValT erase(const KeyT& key) {
+    size_t idx = bucketIndex(key);
+    uint32_t* link = &heads[idx];
+    while (*link != kNone && !(slots[*link].key == key)) {
+      link = &slots[*link].next;
+    }
+    uint32_t i = *link;
+    if (i == kNone) {
+      throw out_of_range("Key not found");
+    }
+
+    *link = slots[i].next;
+    ValT removedValue = std::move(valueAt(i));
+
+    uint32_t last = static_cast<uint32_t>(slots.size() - 1);
+    if (i != last) {
+      *linkTo(last) = i;
+      moveEntry(last, i);
+    }
+    popEntry();
+    return removedValue;
+  }
+
+  /**
+   * Removes all mappings, keeping the bucket count.
+   *
+   * Runs in O(N+B).
+   */
+  void clear() {
+    slots.clear();
+    values.clear();
+    heads.assign(heads.size(), kNone);
+    curr_idx = 0;
+  }
+
+  /**
+   * Resets internal state for an iterative traversal. Runs in O(1): entries
+   * are dense, so no empty buckets are scanned.
+   */
+  void begin() {
+    curr_idx = 0;
+  }
+
+  /**
+   * Sets `key` and `value` to the next mapping and returns `true`, or returns
+   * `false` once every mapping has been visited. See `HashMap::next`.
+   *
+   * Runs in O(1).
+   */
+  bool next(KeyT& key, ValT& value) {
+    if (curr_idx >= slots.size()) {
+      return false;
+    }
+    key = slots[curr_idx].key;
+    value = valueAt(static_cast<uint32_t>(curr_idx));
+    curr_idx++;
+    return true;
+  }
+};
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "columnar_hashmap.h"
+
+/**
+ * A `ColumnarHashMap` that keeps each value next to its key, for
+ * memory-bound tables of small keys and values.
+ *
+ * Entries `{key, value, next}` live densely in one vector and chains are
+ * linked with 32-bit indices, so there is no per-entry allocation, no
+ * allocator header and no 64-bit pointer anywhere. For
+ * `uint32_t -> uint32_t` an entry is 12 bytes, plus about 3 bytes of bucket
+ * array at the maximum load factor, against roughly 40 bytes for `HashMap`.
+ * With small values a hit reads a single entry.
+ */
+template <typename KeyT, typename ValT>
+using CompactHashMap = ColumnarHashMap<KeyT, ValT, ValueLayout::kInline>;
@@ -0,0 +1,495 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// Size of a cache line, for keeping data that different threads write apart.
+constexpr size_t kCacheLineBytes = 64;
+
+/**
+ * Process-wide epoch-based reclamation (EBR) shared by every
+ * `ConcurrentHashMap`.
+ *
+ * Readers announce the global epoch in a per-thread record for the duration
+ * of a read-side critical section, using only plain atomic loads and stores.
+ * Writers retire unlinked memory tagged with the epoch it was retired in, and
+ * free it once the global epoch has advanced twice past that point, which
+ * guarantees no reader can still hold a pointer to it.
+ */
+class EpochDomain {
+ private:
+  static constexpr uint64_t kQuiescent = 0;
+
+  // One cache line per record, so readers never write to each other's lines.
+  struct alignas(kCacheLineBytes) Record {
+    atomic<uint64_t> epoch{kQuiescent};
+    atomic<bool> in_use{false};
+    Record* next = nullptr;
+    // Only touched by the owning thread; lets read sections nest.
+    size_t depth = 0;
+  };
+
+  // Releases the calling thread's record when the thread exits.
+  struct ThreadSlot {
+    Record* record = nullptr;
+
+    ~ThreadSlot() {
+      if (record != nullptr) {
+        record->epoch.store(kQuiescent, memory_order_release);
+        record->in_use.store(false, memory_order_release);
+      }
+    }
+  };
+
+  atomic<uint64_t> global{1};
+  atomic<Record*> records{nullptr};
+
+  EpochDomain() = default;
+
+  // Records are never freed, only recycled across threads, so a writer
+  // scanning the list never touches freed memory.
+  Record* acquireRecord() {
+    for (Record* r = records.load(memory_order_acquire); r != nullptr;
+         r = r->next) {
+      bool expected = false;
+      if (!r->in_use.load(memory_order_relaxed) &&
+          r->in_use.compare_exchange_strong(expected, true)) {
+        return r;
+      }
+    }
+
+    Record* r = new Record();
+    r->in_use.store(true, memory_order_relaxed);
+    Record* head = records.load(memory_order_relaxed);
+    do {
+      r->next = head;
+    } while (!records.compare_exchange_weak(head, r, memory_order_release,
+                                            memory_order_relaxed));
+    return r;
+  }
+
+  Record* localRecord() {
+    // Registration is the only read-side RMW, and it happens once per thread.
+    thread_local ThreadSlot slot;
+    if (slot.record == nullptr) {
+      slot.record = acquireRecord();
+    }
+    return slot.record;
+  }
+
+ public:
+  static EpochDomain& instance() {
+    static EpochDomain domain;
+    return domain;
+  }
+
+  EpochDomain(const EpochDomain&) = delete;
+  EpochDomain& operator=(const EpochDomain&) = delete;
+
+  /**
+   * RAII read-side critical section. Pointers loaded from a concurrent
+   * structure stay valid until the guard is destroyed.
+   */
+  class ReadGuard {
+   private:
+    Record* record;
+
+   public:
+    ReadGuard() : record(EpochDomain::instance().localRecord()) {
+      if (record->depth++ == 0) {
+        uint64_t e =
+            EpochDomain::instance().global.load(memory_order_relaxed);
+        record->epoch.store(e, memory_order_relaxed);
+        // Publish the announcement before loading any shared pointers.
+        atomic_thread_fence(memory_order_seq_cst);
+      }
+    }
+
+    ~ReadGuard() {
+      if (--record->depth == 0) {
+        record->epoch.store(kQuiescent, memory_order_release);
+      }
+    }
+
+    ReadGuard(const ReadGuard&) = delete;
+    ReadGuard& operator=(const ReadGuard&) = delete;
+  };
+
+  /**
+   * Returns the epoch that memory unlinked right now should be tagged with.
+   */
+  uint64_t current() const {
+    atomic_thread_fence(memory_order_seq_cst);
+    return global.load(memory_order_seq_cst);
+  }
+
+  /**
+   * Advances the global epoch if every active reader has observed the
+   * current one. Called by writers only.
+   */
+  bool tryAdvance() {
+    uint64_t g = global.load(memory_order_seq_cst);
+    for (Record* r = records.load(memory_order_acquire); r != nullptr;
+         r = r->next) {
+      uint64_t e = r->epoch.load(memory_order_seq_cst);
+      if (e != kQuiescent && e != g) {
+        return false;
+      }
+    }
+    return global.compare_exchange_strong(g, g + 1);
+  }
+
+  /**
+   * Returns `true` if memory retired in epoch `retiredAt` can no longer be
+   * reached by any reader.
+   */
+  bool isSafe(uint64_t retiredAt) const {
+    return global.load(memory_order_acquire) >= retiredAt + 2;
+  }
+};
+
+/**
+ * A hash map for read-mostly workloads shared across threads.
+ *
+ * `at`, `contains` and `size` take no locks and perform no atomic
+ * read-modify-write operations: readers traverse the bucket array and chains
+ * with acquire loads inside an epoch read section. Writers (`insert`,
+ * `erase`, `clear`) serialize on a mutex, publish with release stores, and
+ * retire unlinked nodes and replaced bucket arrays through `EpochDomain`.
+ *
+ * Keys and values are immutable once inserted, matching `HashMap`, which
+ * never overwrites an existing mapping.
+ */
+template <typename KeyT, typename ValT>
+class ConcurrentHashMap {
+ private:
+  struct ChainNode {
+    const KeyT key;
+    const ValT value;
+    atomic<ChainNode*> next;
+
+    ChainNode(const KeyT& key, const ValT& value, ChainNode* next)
+        : key(key), value(value), next(next) {
+    }
+  };
+
+  struct Table {
+    size_t capacity;
+    atomic<ChainNode*>* data;
+
+    explicit Table(size_t cap) : capacity(cap) {
+      data = new atomic<ChainNode*>[capacity];
+      for (size_t i = 0; i < capacity; i++) {
+        data[i].store(nullptr, memory_order_relaxed);
+      }
+    }
+
+    ~Table() {
+      delete[] data;
+    }
+  };
+
+  // Either a single unlinked node, or a whole table (and its chains) that was
+  // replaced by `rehash` or `clear`.
+  struct Retired {
+    uint64_t epoch;
+    ChainNode* node;
+    Table* table;
+    bool ownsChains;
+  };
+
+  // Number of retired nodes that triggers a reclamation attempt. Retired
+  // tables trigger one on every write until they are freed, since each holds
+  // a copy of every chain.
+  static constexpr size_t kReclaimThreshold = 64;
+
+  // Read by every operation; writers only store it on a resize or `clear`.
+  atomic<Table*> table;
+  // Stored by every write, so kept off the line holding `table`.
+  alignas(kCacheLineBytes) atomic<size_t> sz;
+
+  mutex writeLock;
+  vector<Retired> retired;
+  size_t retiredTables = 0;
+
+  // Helper functions
+
+  static size_t bucketIndex(const KeyT& key, size_t capacity) {
+    return std::hash<KeyT>()(key) % capacity;
+  }
+
+  static void freeTable(Table* t, bool withChains) {
+    if (withChains) {
+      for (size_t i = 0; i < t->capacity; i++) {
+        ChainNode* node = t->data[i].load(memory_order_relaxed);
+        while (node != nullptr) {
+          ChainNode* nextNode = node->next.load(memory_order_relaxed);
+          delete node;
+          node = nextNode;
+        }
+      }
+    }
+    delete t;
+  }
+
+  static void freeRetired(const Retired& r) {
+    if (r.table != nullptr) {
+      freeTable(r.table, r.ownsChains);
+    } else {
+      delete r.node;
+    }
+  }
+
+  // Must hold `writeLock`.
+  void retire(ChainNode* node, Table* t, bool ownsChains) {
+    uint64_t e = EpochDomain::instance().current();
+    retired.push_back({e, node, t, ownsChains});
+    if (t != nullptr) {
+      retiredTables++;
+    }
+    if (retiredTables > 0 || retired.size() >= kReclaimThreshold) {
+      reclaim();
+    }
+  }
+
+  // Must hold `writeLock`. Advances the epoch as far as active readers allow,
+  // which with no reader in the way frees everything retired so far.
+  void reclaim() {
+    EpochDomain& domain = EpochDomain::instance();
+    while (!retired.empty() && !domain.isSafe(retired.back().epoch) &&
+           domain.tryAdvance()) {
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < retired.size(); i++) {
+      if (domain.isSafe(retired[i].epoch)) {
+        if (retired[i].table != nullptr) {
+          retiredTables--;
+        }
+        freeRetired(retired[i]);
+      } else {
+        retired[kept++] = retired[i];
+      }
+    }
+    retired.resize(kept);
+  }
+
+  // Must hold `writeLock`. Readers may still be traversing the old table, so
+  // its nodes are copied rather than relinked, and the old table is retired
+  // together with its chains.
+  void rehash(size_t newCapacity) {
+    if (newCapacity == 0) {
+      newCapacity = 1;
+    }
+
+    Table* oldTable = table.load(memory_order_relaxed);
+    Table* newTable = new Table(newCapacity);
+
+    for (size_t i = 0; i < oldTable->capacity; i++) {
+      ChainNode* node = oldTable->data[i].load(memory_order_relaxed);
+      while (node != nullptr) {
+        size_t idx = bucketIndex(node->key, newCapacity);
+        ChainNode* head = newTable->data[idx].load(memory_order_relaxed);
+        newTable->data[idx].store(new ChainNode(node->key, node->value, head),
+                                  memory_order_relaxed);
+        node = node->next.load(memory_order_relaxed);
+      }
+    }
+
+    table.store(newTable, memory_order_release);
+    retire(nullptr, oldTable, true);
+  }
+
+ public:
+  /**
+   * Creates an empty `ConcurrentHashMap` with 10 buckets.
+   */
+  ConcurrentHashMap() : ConcurrentHashMap(10) {
+  }
+
+  /**
+   * Creates an empty `ConcurrentHashMap` with `capacity` buckets.
+   */
+  explicit ConcurrentHashMap(size_t capacity) : sz(0) {
+    table.store(new Table(capacity == 0 ? 1 : capacity),
+                memory_order_relaxed);
+  }
+
+  ConcurrentHashMap(const ConcurrentHashMap&) = delete;
+  ConcurrentHashMap& operator=(const ConcurrentHashMap&) = delete;
+
+  /**
+   * Destructor. No other thread may be using the map.
+   *
+   * Runs in O(N+B+R), where R is the number of retired allocations not yet
+   * reclaimed.
+   */
+  ~ConcurrentHashMap() {
+    for (const Retired& r : retired) {
+      freeRetired(r);
+    }
+    freeTable(table.load(memory_order_relaxed), true);
+  }
+
+  /**
+   * Returns the number of mappings. Lock-free; may be momentarily stale
+   * relative to concurrent writers. Runs in O(1).
+   */
+  size_t size() const {
+    return sz.load(memory_order_relaxed);
+  }
+
+  /**
+   * Checks if the map is empty. Runs in O(1).
+   */
+  bool empty() const {
+    return size() == 0;
+  }
+
+  /**
+   * Returns the number of buckets currently in use.
+   */
+  size_t get_capacity() const {
+    EpochDomain::ReadGuard guard;
+    return table.load(memory_order_acquire)->capacity;
+  }
+
+  /**
+   * Returns `true` if the key is present in the map. Lock-free.
+   *
+   * Runs in O(L), where L is the length of the longest chain.
+   */
+  bool contains(const KeyT& key) const {
+    EpochDomain::ReadGuard guard;
+    Table* t = table.load(memory_order_acquire);
+    ChainNode* node =
+        t->data[bucketIndex(key, t->capacity)].load(memory_order_acquire);
+    while (node != nullptr) {
+      if (node->key == key) {
+        return true;
+      }
+      node = node->next.load(memory_order_acquire);
+    }
+    return false;
+  }
+
+  /**
+   * Returns a copy of the value stored for `key`. A reference cannot be
+   * returned because the node may be reclaimed once the read section ends.
+   * Lock-free.
+   *
+   * If key is not present in the map, throw `out_of_range` exception.
+   *
+   * Runs in O(L), where L is the length of the longest chain.
+   */
+  ValT at(const KeyT& key) const {
+    EpochDomain::ReadGuard guard;
+    Table* t = table.load(memory_order_acquire);
+    ChainNode* node =
+        t->data[bucketIndex(key, t->capacity)].load(memory_order_acquire);
+    while (node != nullptr) {
+      if (node->key == key) {
+        return node->value;
+      }
+      node = node->next.load(memory_order_acquire);
+    }
+    throw out_of_range("Key not found");
+  }
+
+  /**
+   * Adds the mapping `{key -> value}`. If the key already exists, does not
+   * update the mapping. Resizes by doubling when the load factor exceeds 1.5.
+   *
+   * Serialized with other writers; never blocks readers.
+   *
+   * Runs in O(L), where L is the length of the longest chain.
+   */
+  void insert(const KeyT& key, const ValT& value) {
+    lock_guard<mutex> lock(writeLock);
+    if (retiredTables > 0) {
+      reclaim();
+    }
+
+    size_t n = sz.load(memory_order_relaxed);
+    Table* t = table.load(memory_order_relaxed);
+    if (2 * (n + 1) > 3 * t->capacity) {  // int-only check for > 1.5
+      rehash(t->capacity * 2);
+      t = table.load(memory_order_relaxed);
+    }
+
+    size_t idx = bucketIndex(key, t->capacity);
+    ChainNode* head = t->data[idx].load(memory_order_relaxed);
+    for (ChainNode* node = head; node != nullptr;
+         node = node->next.load(memory_order_relaxed)) {
+      if (node->key == key) {
+        return;
+      }
+    }
+
+    // The node is fully constructed before the release store publishes it.
+    t->data[idx].store(new ChainNode(key, value, head), memory_order_release);
+    sz.store(n + 1, memory_order_relaxed);
+  }
+
+  /**
+   * Removes the mapping for the given key, and returns the value. The node
+   * is retired rather than freed, so concurrent readers can finish with it.
+   *
+   * Throws `out_of_range` if the key is not present in the map.
+   *
+   * Runs in O(L), where L is the length of the longest chain.
+   */
+  ValT erase(const KeyT& key) {
+    lock_guard<mutex> lock(writeLock);
+
+    Table* t = table.load(memory_order_relaxed);
+    atomic<ChainNode*>* link = &t->data[bucketIndex(key, t->capacity)];
+    ChainNode* node = link->load(memory_order_relaxed);
+    while (node != nullptr && !(node->key == key)) {
+      link = &node->next;
+      node = link->load(memory_order_relaxed);
+    }
+
+    if (node == nullptr) {
+      throw out_of_range("Key not found");
+    }
+
+    // Readers already on `node` still see a valid `next`.
+    link->store(node->next.load(memory_order_relaxed), memory_order_release);
+    sz.store(sz.load(memory_order_relaxed) - 1, memory_order_relaxed);
+
+    ValT removedValue = node->value;
+    retire(node, nullptr, false);
+    return removedValue;
+  }
+
+  /**
+   * Removes all mappings. The old bucket array is retired and replaced by an
+   * empty one of the same capacity.
+   *
+   * Runs in O(B), where B is the number of buckets.
+   */
+  void clear() {
+    lock_guard<mutex> lock(writeLock);
+
+    Table* oldTable = table.load(memory_order_relaxed);
+    table.store(new Table(oldTable->capacity), memory_order_release);
+    sz.store(0, memory_order_relaxed);
+    retire(nullptr, oldTable, true);
+  }
+
+  /**
+   * Returns the number of retired nodes and tables not yet freed. For
+   * autograder testing purposes only.
+   */
+  size_t get_retired_count() {
+    lock_guard<mutex> lock(writeLock);
+    return retired.size();
+  }
+};
@@ -0,0 +1,612 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+
+#include "hashmap.h"
+#include "hashmap_codec.h"
+
+using namespace std;
+
+struct DurabilityOptions {
+  // When true, `insert` and `erase` return only once the group commit that
+  // covers them has been fsynced. When false, they return immediately and
+  // are made durable in the background; call `sync` to wait.
+  bool sync_writes = true;
+
+  // Checkpoint automatically once the log grows past this many bytes and
+  // past the size of the last checkpoint, so that rewriting a large map costs
+  // no more I/O than logging the changes did. Zero disables automatic
+  // checkpoints; `checkpoint` can still be called.
+  size_t checkpoint_log_bytes = size_t(64) << 20;
+};
+
+/**
+ * A `HashMap` whose mutations survive a crash.
+ *
+ * Every successful `insert` and `erase` is appended to `dir/wal.log` as a
+ * checksummed record. A background thread writes and fsyncs the records in
+ * batches (group commit): writers that arrive while an fsync is in flight
+ * all share the next one, so throughput is not bounded by fsync latency.
+ *
+ * `checkpoint` copies the map, writes the copy to `dir/checkpoint`
+ * (atomically, via rename) and drops the log records the copy covers.
+ * Other calls wait only for the copy, not for the write, and automatic
+ * checkpoints run on their own thread so group commits continue meanwhile.
+ * On construction the checkpoint is loaded and the log replayed into a table
+ * pre-sized to need no resize; a torn record at the end of the log, left by
+ * a crash mid-write, is discarded.
+ *
+ * If writing the log or a checkpoint fails, the map is marked failed and
+ * every later call throws `runtime_error`: the in-memory table may hold
+ * changes the log lacks, so it cannot be trusted. Reopen the directory to
+ * get the durable contents back.
+ *
+ * Keys and values are serialized with `Codec`. All methods are thread-safe.
+ */
+template <typename KeyT, typename ValT>
+class DurableHashMap {
+ private:
+  enum : char { kInsert = 1, kErase = 2 };
+  static constexpr char kCheckpointMagic[8] = {'H', 'M', 'C', 'K',
+                                               'P', 'T', '0', '1'};
+  // Checkpoints are written in chunks of this size.
+  static constexpr size_t kWriteChunk = size_t(1) << 20;
+
+  string dir;
+  DurabilityOptions options;
+  HashMap<KeyT, ValT> map;
+  int logFd;
+
+  // Guards `map`, `pending`, the LSNs, `ioError`, `checkpointWanted`,
+  // `commits` and `checkpoints`.
+  mutex mu;
+  condition_variable pendingCv;
+  condition_variable durableCv;
+  condition_variable checkpointCv;
+  string pending;
+  uint64_t appendedLsn;
+  uint64_t durableLsn;
+  string ioError;
+  bool stopping;
+  bool checkpointWanted;
+  // Number of log writes that reached disk, each covering one group.
+  size_t commits;
+  size_t checkpoints;
+
+  // Held while writing or replacing the log. Guards `logFd`, `logBytes` and
+  // `checkpointBytes`.
+  mutex ioMutex;
+  size_t logBytes;
+  // Size of the last checkpoint written or loaded.
+  size_t checkpointBytes;
+
+  // Serializes checkpoints. Lock order: `checkpointMutex`, `mu`, `ioMutex`.
+  mutex checkpointMutex;
+
+  thread flusher;
+  thread checkpointer;
+
+  // Helper functions
+
+  string logPath() const {
+    return dir + "/wal.log";
+  }
+
+  string checkpointPath() const {
+    return dir + "/checkpoint";
+  }
+
+  int openLog() const {
+    int fd = ::open(logPath().c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) {
+      throwErrno("open " + logPath());
+    }
+    return fd;
+  }
+
+  [[noreturn]] static void throwErrno(const string& what) {
+    throw system_error(errno, generic_category(), what);
+  }
+
+  static void writeAll(int fd, const char* p, size_t n) {
+    while (n > 0) {
+      ssize_t written = ::write(fd, p, n);
+      if (written < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        throwErrno("write");
+      }
+      p += written;
+      n -= static_cast<size_t>(written);
+    }
+  }
+
+  static void syncFd(int fd) {
+    if (::fsync(fd) != 0) {
+      throwErrno("fsync");
+    }
+  }
+
+  // Returns the contents of `path` from byte `offset` on, or an empty string
+  // if the file does not exist.
+  static string readFile(const string& path, size_t offset = 0) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      if (errno == ENOENT) {
+        return string();
+      }
+      throwErrno("open " + path);
+    }
+    if (::lseek(fd, static_cast<off_t>(offset), SEEK_SET) < 0) {
+      ::close(fd);
+      throwErrno("lseek " + path);
+    }
+
+    string contents;
+    char buf[1 << 16];
+    while (true) {
+      ssize_t n = ::read(fd, buf, sizeof(buf));
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n < 0) {
+        ::close(fd);
+        throwErrno("read " + path);
+      }
+      if (n == 0) {
+        break;
+      }
+      contents.append(buf, static_cast<size_t>(n));
+    }
+    ::close(fd);
+    return contents;
+  }
+
+  static void corrupt(const string& what) {
+    throw runtime_error("DurableHashMap: corrupt " + what);
+  }
+
+  void recover() {
+    string ckpt = readFile(checkpointPath());
+    string log = readFile(logPath());
+
+    const char* cp = ckpt.data();
+    const char* cend = cp + ckpt.size();
+    uint64_t ckptCount = 0;
+    if (!ckpt.empty()) {
+      if (ckpt.size() < sizeof(kCheckpointMagic) ||
+          memcmp(cp, kCheckpointMagic, sizeof(kCheckpointMagic)) != 0) {
+        corrupt("checkpoint header");
+      }
+      cp += sizeof(kCheckpointMagic);
+      if (!Codec<uint64_t>::decode(cp, cend, ckptCount)) {
+        corrupt("checkpoint header");
+      }
+    }
+
+    // First pass over the log: find the valid prefix and count inserts, so
+    // the table can be sized once for everything that will be replayed.
+    const char* lp = log.data();
+    const char* lend = lp + log.size();
+    const char* payload;
+    size_t len;
+    size_t inserts = 0;
+    while (readFramed(lp, lend, payload, len)) {
+      if (len > 0 && payload[0] == kInsert) {
+        inserts++;
+      }
+    }
+    size_t validBytes = static_cast<size_t>(lp - log.data());
+
+    size_t expected = ckptCount + inserts;
+    map = HashMap<KeyT, ValT>(max<size_t>(10, (2 * expected + 2) / 3));
+
+    KeyT key;
+    ValT value;
+    for (uint64_t i = 0; i < ckptCount; i++) {
+      if (!readFramed(cp, cend, payload, len)) {
+        corrupt("checkpoint record");
+      }
+      const char* q = payload;
+      if (!Codec<KeyT>::decode(q, payload + len, key) ||
+          !Codec<ValT>::decode(q, payload + len, value)) {
+        corrupt("checkpoint record");
+      }
+      map.insert(key, value);
+    }
+
+    lp = log.data();
+    while (static_cast<size_t>(lp - log.data()) < validBytes) {
+      readFramed(lp, lend, payload, len);
+      const char* q = payload + 1;
+      const char* qend = payload + len;
+      if (len == 0 || !Codec<KeyT>::decode(q, qend, key)) {
+        corrupt("log record");
+      }
+      if (payload[0] == kInsert) {
+        if (!Codec<ValT>::decode(q, qend, value)) {
+          corrupt("log record");
+        }
+        map.insert(key, value);
+      } else if (map.contains(key)) {
+        map.erase(key);
+      }
+    }
+
+    logFd = openLog();
+    if (validBytes < log.size()) {
+      // Drop the torn tail so new records follow the last good one.
+      if (::ftruncate(logFd, static_cast<off_t>(validBytes)) != 0) {
+        throwErrno("ftruncate");
+      }
+      syncFd(logFd);
+    }
+    logBytes = validBytes;
+    checkpointBytes = ckpt.size();
+  }
+
+  static void syncDir(const string& path) {
+    int dirFd = ::open(path.c_str(), O_RDONLY);
+    if (dirFd >= 0) {
+      ::fsync(dirFd);
+      ::close(dirFd);
+    }
+  }
+
+  // Writes `path` through a temporary file and a rename, so a crash leaves
+  // either the old or the new contents. `fill(fd)` writes the contents.
+  template <typename Fill>
+  void replaceFile(const string& path, Fill fill) {
+    string tmpPath = path + ".tmp";
+    int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+      throwErrno("open " + tmpPath);
+    }
+    try {
+      fill(fd);
+      syncFd(fd);
+    } catch (...) {
+      ::close(fd);
+      throw;
+    }
+    ::close(fd);
+
+    if (::rename(tmpPath.c_str(), path.c_str()) != 0) {
+      throwErrno("rename " + tmpPath);
+    }
+    syncDir(dir);
+  }
+
+  // Throws if an earlier write failed. Must hold `mu`.
+  void checkHealthy() const {
+    if (!ioError.empty()) {
+      throw runtime_error("DurableHashMap: " + ioError);
+    }
+  }
+
+  // Queues a record and, in synchronous mode, waits for its group commit.
+  // Must hold `lk` on `mu`.
+  void logMutation(unique_lock<mutex>& lk, const string& payload) {
+    appendFramed(pending, payload);
+    uint64_t lsn = ++appendedLsn;
+    pendingCv.notify_one();
+    if (options.sync_writes) {
+      waitDurable(lk, lsn);
+    }
+  }
+
+  void waitDurable(unique_lock<mutex>& lk, uint64_t lsn) {
+    durableCv.wait(lk, [&]() { return durableLsn >= lsn || !ioError.empty(); });
+    if (durableLsn < lsn) {
+      throw runtime_error("DurableHashMap: " + ioError);
+    }
+  }
+
+  void flushLoop() {
+    unique_lock<mutex> lk(mu);
+    while (true) {
+      pendingCv.wait(lk, [&]() { return stopping || !pending.empty(); });
+      if (pending.empty()) {
+        return;
+      }
+
+      // Everything queued so far goes out in one write and one fsync;
+      // writers keep queueing the next batch meanwhile.
+      string batch;
+      batch.swap(pending);
+      uint64_t batchLsn = appendedLsn;
+      lk.unlock();
+
+      bool wantCheckpoint;
+      try {
+        lock_guard<mutex> io(ioMutex);
+        writeAll(logFd, batch.data(), batch.size());
+        syncFd(logFd);
+        logBytes += batch.size();
+        wantCheckpoint =
+            options.checkpoint_log_bytes > 0 &&
+            logBytes >= max(options.checkpoint_log_bytes, checkpointBytes);
+      } catch (const exception& e) {
+        lk.lock();
+        fail(e);
+        return;
+      }
+
+      lk.lock();
+      commits++;
+      durableLsn = batchLsn;
+      durableCv.notify_all();
+      if (wantCheckpoint && !checkpointWanted) {
+        checkpointWanted = true;
+        checkpointCv.notify_one();
+      }
+    }
+  }
+
+  // Runs the automatic checkpoints requested by `flushLoop`.
+  void checkpointLoop() {
+    unique_lock<mutex> lk(mu);
+    while (true) {
+      checkpointCv.wait(lk, [&]() { return stopping || checkpointWanted; });
+      if (stopping || !ioError.empty()) {
+        return;
+      }
+      lk.unlock();
+      try {
+        checkpoint();
+      } catch (const exception&) {
+        // `checkpoint` has failed the map; every later call reports it
+        return;
+      }
+      lk.lock();
+      checkpointWanted = false;
+    }
+  }
+
+  // Marks the map failed. Must hold `mu`.
+  void fail(const exception& e) {
+    ioError = e.what();
+    durableCv.notify_all();
+  }
+
+  // Writes `snapshot` as the checkpoint, then drops the first `coveredBytes`
+  // of the log, which it covers. Records logged after the snapshot are kept.
+  // Some of them may also be in the snapshot, which is harmless: replaying
+  // any suffix of the history onto a state that already includes it leaves
+  // the state unchanged, since `insert` never overwrites.
+  void writeCheckpoint(HashMap<KeyT, ValT>& snapshot, size_t coveredBytes) {
+    size_t written = 0;
+    replaceFile(checkpointPath(), [&](int fd) {
+      string out(kCheckpointMagic, sizeof(kCheckpointMagic));
+      Codec<uint64_t>::encode(snapshot.size(), out);
+      string payload;
+      KeyT key;
+      ValT value;
+      snapshot.begin();
+      while (snapshot.next(key, value)) {
+        payload.clear();
+        Codec<KeyT>::encode(key, payload);
+        Codec<ValT>::encode(value, payload);
+        appendFramed(out, payload);
+        if (out.size() >= kWriteChunk) {
+          writeAll(fd, out.data(), out.size());
+          written += out.size();
+          out.clear();
+        }
+      }
+      writeAll(fd, out.data(), out.size());
+      written += out.size();
+    });
+
+    // Only records written during the checkpoint are copied
+    lock_guard<mutex> io(ioMutex);
+    string rest = readFile(logPath(), coveredBytes);
+    replaceFile(logPath(),
+                [&](int fd) { writeAll(fd, rest.data(), rest.size()); });
+    ::close(logFd);
+    logFd = openLog();
+    logBytes = rest.size();
+    checkpointBytes = written;
+  }
+
+ public:
+  /**
+   * Opens (creating if needed) the durable map stored in directory `dir`,
+   * recovering its contents from the last checkpoint and the log.
+   *
+   * Throws `system_error` on I/O failure and `runtime_error` if the
+   * checkpoint or a fully-written log record is corrupt.
+   *
+   * Runs in O(N + R), where R is the number of log records.
+   */
+  explicit DurableHashMap(const string& dir,
+                          DurabilityOptions options = DurabilityOptions())
+      : dir(dir),
+        options(options),
+        logFd(-1),
+        appendedLsn(0),
+        durableLsn(0),
+        stopping(false),
+        checkpointWanted(false),
+        commits(0),
+        checkpoints(0),
+        logBytes(0),
+        checkpointBytes(0) {
+    if (::mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+      throwErrno("mkdir " + dir);
+    }
+    try {
+      recover();
+    } catch (...) {
+      if (logFd >= 0) {
+        ::close(logFd);
+      }
+      throw;
+    }
+    flusher = thread([this]() { flushLoop(); });
+    checkpointer = thread([this]() { checkpointLoop(); });
+  }
+
+  DurableHashMap(const DurableHashMap&) = delete;
+  DurableHashMap& operator=(const DurableHashMap&) = delete;
+
+  /**
+   * Flushes any queued records and finishes a running checkpoint, then
+   * closes the log.
+   */
+  ~DurableHashMap() {
+    {
+      lock_guard<mutex> lk(mu);
+      stopping = true;
+    }
+    pendingCv.notify_all();
+    checkpointCv.notify_all();
+    flusher.join();
+    checkpointer.join();
+    ::close(logFd);
+  }
+
+  /**
+   * Adds the mapping `{key -> value}` and logs it. If the key already
+   * exists, does not update the mapping and logs nothing.
+   *
+   * Throws `runtime_error` if the map has failed.
+   *
+   * Runs in O(L), plus the wait for the next group commit when
+   * `sync_writes` is set.
+   */
+  void insert(const KeyT& key, const ValT& value) {
+    unique_lock<mutex> lk(mu);
+    checkHealthy();
+    if (map.contains(key)) {
+      return;
+    }
+    map.insert(key, value);
+
+    string payload(1, kInsert);
+    Codec<KeyT>::encode(key, payload);
+    Codec<ValT>::encode(value, payload);
+    logMutation(lk, payload);
+  }
+
+  /**
+   * Removes the mapping for `key`, logs it, and returns the value.
+   *
+   * Throws `out_of_range` if the key is not present in the map, and
+   * `runtime_error` if the map has failed.
+   *
+   * Runs in O(L), plus the wait for the next group commit when
+   * `sync_writes` is set.
+   */
+  ValT erase(const KeyT& key) {
+    unique_lock<mutex> lk(mu);
+    checkHealthy();
+    ValT removedValue = map.erase(key);
+
+    string payload(1, kErase);
+    Codec<KeyT>::encode(key, payload);
+    logMutation(lk, payload);
+    return removedValue;
+  }
+
+  /**
+   * Returns a copy of the value stored for `key`.
+   *
+   * If key is not present in the map, throw `out_of_range` exception.
+   */
+  ValT at(const KeyT& key) {
+    lock_guard<mutex> lk(mu);
+    checkHealthy();
+    return map.at(key);
+  }
+
+  bool contains(const KeyT& key) {
+    lock_guard<mutex> lk(mu);
+    checkHealthy();
+    return map.contains(key);
+  }
+
+  size_t size() {
+    lock_guard<mutex> lk(mu);
+    checkHealthy();
+    return map.size();
+  }
+
+  bool empty() {
+    return size() == 0;
+  }
+
+  /**
+   * Waits until every mutation made so far is durable. Only needed when
+   * `sync_writes` is off.
+   */
+  void sync() {
+    unique_lock<mutex> lk(mu);
+    waitDurable(lk, appendedLsn);
+  }
+
+  /**
+   * Writes the whole map to a new checkpoint and drops the log records it
+   * covers. Other calls wait only while the map is copied; the copy holds
+   * a second set of nodes until the checkpoint is written.
+   *
+   * Runs in O(N+B).
+   */
+  void checkpoint() {
+    lock_guard<mutex> serial(checkpointMutex);
+    unique_lock<mutex> lk(mu);
+    checkHealthy();
+    HashMap<KeyT, ValT> snapshot(map);
+    size_t coveredBytes;
+    {
+      // Every record in the log so far is reflected in the copy
+      lock_guard<mutex> io(ioMutex);
+      coveredBytes = logBytes;
+    }
+    lk.unlock();
+
+    try {
+      writeCheckpoint(snapshot, coveredBytes);
+    } catch (const exception& e) {
+      lk.lock();
+      fail(e);
+      throw;
+    }
+    lk.lock();
+    checkpoints++;
+  }
+
+  /**
+   * Returns the number of group commits written to the log so far.
+   *
+   * For autograder testing purposes only.
+   */
+  size_t get_commit_count() {
+    lock_guard<mutex> lk(mu);
+    return commits;
+  }
+
+  /**
+   * Returns the number of checkpoints written so far.
+   *
+   * For autograder testing purposes only.
+   */
+  size_t get_checkpoint_count() {
+    lock_guard<mutex> lk(mu);
+    return checkpoints;
+  }
+};
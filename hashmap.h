@@ -1,26 +1,762 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <coroutine>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <functional>
 #include <iostream>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <optional>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <thread>
+#include <type_traits>
 #include <utility>
+#include <vector>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define HASHMAP_X86_KERNELS 1
+#endif
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 using namespace std;
 
+enum class PageBacking {
+  kDefault,          // operator new[]
+  kTransparentHuge,  // 2 MB-aligned mmap + MADV_HUGEPAGE
+  kHuge2M,           // MAP_HUGETLB 2 MB pages
+  kHuge1G,           // MAP_HUGETLB 1 GB pages
+};
+
+enum class NumaPlacement {
+  kDefault,     // first touch
+  kInterleave,  // pages spread round-robin over `node_mask`
+  kBind,        // pages restricted to `node_mask`
+};
+
+/**
+ * How `HashMap` backs its bucket array. With hundreds of millions of buckets
+ * every lookup is a TLB miss on 4 KB pages as well as a cache miss; huge
+ * pages remove most of the former.
+ *
+ * Explicit huge pages need pages reserved by the administrator
+ * (`vm.nr_hugepages`); when none are available, and on platforms without
+ * `mmap`, the map silently falls back to the next weaker backing. NUMA
+ * placement is a hint and is skipped if `mbind` fails.
+ */
+struct MemoryPolicy {
+  PageBacking pages = PageBacking::kDefault;
+  NumaPlacement numa = NumaPlacement::kDefault;
+  // Bit i selects NUMA node i. Zero disables placement.
+  unsigned long node_mask = 0;
+  // Arrays smaller than this always use operator new[].
+  size_t min_bytes = size_t(2) << 20;
+};
+
+// Maps at least `bytes` of zeroed memory according to `policy` and sets
+// `mapped` to the length to pass to `unmapBucketMemory`. Returns nullptr if
+// the policy asks for plain heap memory or mapping fails.
+inline void* mapBucketMemory(size_t bytes, const MemoryPolicy& policy,
+                             size_t& mapped) {
+  mapped = 0;
+#ifdef __linux__
+  bool placed = policy.numa != NumaPlacement::kDefault && policy.node_mask;
+  if ((policy.pages == PageBacking::kDefault && !placed) ||
+      bytes < policy.min_bytes) {
+    return nullptr;
+  }
+
+  const int prot = PROT_READ | PROT_WRITE;
+  const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+  const size_t kHuge = size_t(2) << 20;
+  void* p = MAP_FAILED;
+  size_t len = 0;
+
+  if (policy.pages == PageBacking::kHuge2M ||
+      policy.pages == PageBacking::kHuge1G) {
+    bool gig = policy.pages == PageBacking::kHuge1G;
+    size_t page = gig ? size_t(1) << 30 : kHuge;
+    len = (bytes + page - 1) / page * page;
+    // MAP_HUGE_2MB / MAP_HUGE_1GB: log2 of the page size in the high bits
+    int sizeFlag = (gig ? 30 : 21) << 26;
+    p = mmap(nullptr, len, prot, flags | MAP_HUGETLB | sizeFlag, -1, 0);
+  }
+
+  if (p == MAP_FAILED && policy.pages != PageBacking::kDefault) {
+    // Transparent huge pages only back 2 MB-aligned ranges, so over-map and
+    // trim to an aligned window.
+    len = (bytes + kHuge - 1) / kHuge * kHuge;
+    void* raw = mmap(nullptr, len + kHuge, prot, flags, -1, 0);
+    if (raw == MAP_FAILED) {
+      return nullptr;
+    }
+    uintptr_t start = (reinterpret_cast<uintptr_t>(raw) + kHuge - 1) &
+                      ~uintptr_t(kHuge - 1);
+    size_t head = start - reinterpret_cast<uintptr_t>(raw);
+    if (head > 0) {
+      munmap(raw, head);
+    }
+    // The tail is kHuge - head bytes, so there is always one to trim.
+    munmap(reinterpret_cast<char*>(start) + len, kHuge - head);
+    p = reinterpret_cast<void*>(start);
+    madvise(p, len, MADV_HUGEPAGE);
+  }
+
+  if (p == MAP_FAILED) {
+    long page = sysconf(_SC_PAGESIZE);
+    len = (bytes + page - 1) / page * page;
+    p = mmap(nullptr, len, prot, flags, -1, 0);
+    if (p == MAP_FAILED) {
+      return nullptr;
+    }
+  }
+
+  if (placed) {
+    // MPOL_BIND = 2, MPOL_INTERLEAVE = 3. Pages are not touched yet, so
+    // the policy applies to all of them.
+    int mode = policy.numa == NumaPlacement::kBind ? 2 : 3;
+    unsigned long mask = policy.node_mask;
+    syscall(SYS_mbind, p, len, mode, &mask, sizeof(mask) * 8 + 1, 0);
+  }
+
+  mapped = len;
+  return p;
+#else
+  (void)bytes;
+  (void)policy;
+  return nullptr;
+#endif
+}
+
+inline void unmapBucketMemory(void* p, size_t mapped) {
+#ifdef __linux__
+  munmap(p, mapped);
+#else
+  (void)p;
+  (void)mapped;
+#endif
+}
+
+// Batch reduction of hashes to bucket indices: `out[i] = h[i] % d`.
+//
+// The SIMD kernels use Lemire's fastmod: with M = ceil(2^64 / d),
+// a % d == ((M * a mod 2^64) * d) >> 64 for any 32-bit a and d, which needs
+// only 32x32->64-bit multiplies. Groups holding a hash of 2^32 or more (as
+// `std::hash<string>` and most 64-bit hashes give) use Barrett reduction
+// instead: with m = floor((2^64 - 1) / d), q = (a * m) >> 64 is a / d or
+// one less, so a - q * d needs at most one subtraction of d. Any `d` of 2^32
+// or more, or below 2, takes the scalar `%`.
+
+inline void bucketIndicesScalar(const size_t* h, size_t n, size_t d,
+                                size_t* out) {
+  for (size_t i = 0; i < n; i++) {
+    out[i] = h[i] % d;
+  }
+}
+
+#ifdef HASHMAP_X86_KERNELS
+// (a * b) >> 64 for each 64-bit lane, from four 32x32->64-bit products.
+__attribute__((target("avx2"))) inline __m256i mulHi64Avx2(__m256i a,
+                                                          __m256i b) {
+  const __m256i lo32 = _mm256_set1_epi64x(UINT32_MAX);
+  __m256i aHi = _mm256_srli_epi64(a, 32);
+  __m256i bHi = _mm256_srli_epi64(b, 32);
+  __m256i p00 = _mm256_mul_epu32(a, b);
+  __m256i p01 = _mm256_mul_epu32(a, bHi);
+  __m256i p10 = _mm256_mul_epu32(aHi, b);
+  __m256i p11 = _mm256_mul_epu32(aHi, bHi);
+  __m256i mid = _mm256_add_epi64(
+      _mm256_srli_epi64(p00, 32),
+      _mm256_add_epi64(_mm256_and_si256(p01, lo32),
+                       _mm256_and_si256(p10, lo32)));
+  return _mm256_add_epi64(
+      _mm256_add_epi64(p11, _mm256_srli_epi64(mid, 32)),
+      _mm256_add_epi64(_mm256_srli_epi64(p01, 32), _mm256_srli_epi64(p10, 32)));
+}
+
+// a % d for any 64-bit lanes `a`, by Barrett reduction with m (see above).
+__attribute__((target("avx2"))) inline __m256i wideModAvx2(__m256i a,
+                                                          __m256i m,
+                                                          __m256i dv) {
+  __m256i q = mulHi64Avx2(a, m);
+  // q * d mod 2^64, d being 32-bit
+  __m256i qd = _mm256_add_epi64(
+      _mm256_mul_epu32(q, dv),
+      _mm256_slli_epi64(_mm256_mul_epu32(_mm256_srli_epi64(q, 32), dv), 32));
+  // r < 2d < 2^33, so the signed compare is exact
+  __m256i r = _mm256_sub_epi64(a, qd);
+  __m256i below = _mm256_cmpgt_epi64(dv, r);
+  return _mm256_sub_epi64(r, _mm256_andnot_si256(below, dv));
+}
+
+__attribute__((target("avx2"))) inline void bucketIndicesAvx2(
+    const size_t* h, size_t n, size_t d, size_t* out) {
+  if (d > UINT32_MAX || d < 2) {
+    bucketIndicesScalar(h, n, d, out);
+    return;
+  }
+  uint64_t m = UINT64_MAX / d + 1;
+  const __m256i mLo = _mm256_set1_epi64x(static_cast<int64_t>(m & UINT32_MAX));
+  const __m256i mHi = _mm256_set1_epi64x(static_cast<int64_t>(m >> 32));
+  const __m256i barrett = _mm256_set1_epi64x(static_cast<int64_t>(m - 1));
+  const __m256i dv = _mm256_set1_epi64x(static_cast<int64_t>(d));
+  const __m256i high = _mm256_set1_epi64x(~int64_t(UINT32_MAX));
+
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(h + i));
+    __m256i r;
+    if (!_mm256_testz_si256(a, high)) {
+      r = wideModAvx2(a, barrett, dv);
+    } else {
+      // low = M * a mod 2^64
+      __m256i low = _mm256_add_epi64(
+          _mm256_mul_epu32(a, mLo),
+          _mm256_slli_epi64(_mm256_mul_epu32(a, mHi), 32));
+      // (low * d) >> 64, from the two 32-bit halves of `low`
+      __m256i lowPart = _mm256_srli_epi64(_mm256_mul_epu32(low, dv), 32);
+      __m256i highPart = _mm256_mul_epu32(_mm256_srli_epi64(low, 32), dv);
+      r = _mm256_srli_epi64(_mm256_add_epi64(highPart, lowPart), 32);
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), r);
+  }
+  bucketIndicesScalar(h + i, n - i, d, out + i);
+}
+
+// GCC 12's AVX-512 headers trip -Wmaybe-uninitialized at -O2 (GCC bug
+// 105593); the warning is about the intrinsics, not this code.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+// (a * b) >> 64 for each 64-bit lane; see `mulHi64Avx2`.
+__attribute__((target("avx512f"))) inline __m512i mulHi64Avx512(__m512i a,
+                                                               __m512i b) {
+  const __m512i lo32 = _mm512_set1_epi64(UINT32_MAX);
+  __m512i aHi = _mm512_srli_epi64(a, 32);
+  __m512i bHi = _mm512_srli_epi64(b, 32);
+  __m512i p00 = _mm512_mul_epu32(a, b);
+  __m512i p01 = _mm512_mul_epu32(a, bHi);
+  __m512i p10 = _mm512_mul_epu32(aHi, b);
+  __m512i p11 = _mm512_mul_epu32(aHi, bHi);
+  __m512i mid = _mm512_add_epi64(
+      _mm512_srli_epi64(p00, 32),
+      _mm512_add_epi64(_mm512_and_si512(p01, lo32),
+                       _mm512_and_si512(p10, lo32)));
+  return _mm512_add_epi64(
+      _mm512_add_epi64(p11, _mm512_srli_epi64(mid, 32)),
+      _mm512_add_epi64(_mm512_srli_epi64(p01, 32), _mm512_srli_epi64(p10, 32)));
+}
+
+// a % d for any 64-bit lanes `a`; see `wideModAvx2`.
+__attribute__((target("avx512f"))) inline __m512i wideModAvx512(__m512i a,
+                                                               __m512i m,
+                                                               __m512i dv) {
+  __m512i q = mulHi64Avx512(a, m);
+  __m512i qd = _mm512_add_epi64(
+      _mm512_mul_epu32(q, dv),
+      _mm512_slli_epi64(_mm512_mul_epu32(_mm512_srli_epi64(q, 32), dv), 32));
+  __m512i r = _mm512_sub_epi64(a, qd);
+  return _mm512_mask_sub_epi64(r, _mm512_cmpge_epu64_mask(r, dv), r, dv);
+}
+
+// Fastmod of eight 32-bit lanes; see above.
+__attribute__((target("avx512f"))) inline __m512i fastModAvx512(__m512i a,
+                                                               __m512i mLo,
+                                                               __m512i mHi,
+                                                               __m512i dv) {
+  __m512i low =
+      _mm512_add_epi64(_mm512_mul_epu32(a, mLo),
+                       _mm512_slli_epi64(_mm512_mul_epu32(a, mHi), 32));
+  return _mm512_srli_epi64(
+      _mm512_add_epi64(_mm512_mul_epu32(_mm512_srli_epi64(low, 32), dv),
+                       _mm512_srli_epi64(_mm512_mul_epu32(low, dv), 32)),
+      32);
+}
+
+__attribute__((target("avx512f"))) inline void bucketIndicesAvx512(
+    const size_t* h, size_t n, size_t d, size_t* out) {
+  if (d > UINT32_MAX || d < 2) {
+    bucketIndicesScalar(h, n, d, out);
+    return;
+  }
+  uint64_t m = UINT64_MAX / d + 1;
+  const __m512i mLo = _mm512_set1_epi64(static_cast<int64_t>(m & UINT32_MAX));
+  const __m512i mHi = _mm512_set1_epi64(static_cast<int64_t>(m >> 32));
+  const __m512i barrett = _mm512_set1_epi64(static_cast<int64_t>(m - 1));
+  const __m512i dv = _mm512_set1_epi64(static_cast<int64_t>(d));
+  const __m512i high = _mm512_set1_epi64(~int64_t(UINT32_MAX));
+
+  // Two vectors (16 keys) per iteration to hide multiply latency
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m512i a0 = _mm512_loadu_si512(h + i);
+    __m512i a1 = _mm512_loadu_si512(h + i + 8);
+    __m512i r0;
+    __m512i r1;
+    if (_mm512_test_epi64_mask(_mm512_or_si512(a0, a1), high) != 0) {
+      r0 = wideModAvx512(a0, barrett, dv);
+      r1 = wideModAvx512(a1, barrett, dv);
+    } else {
+      r0 = fastModAvx512(a0, mLo, mHi, dv);
+      r1 = fastModAvx512(a1, mLo, mHi, dv);
+    }
+    _mm512_storeu_si512(out + i, r0);
+    _mm512_storeu_si512(out + i + 8, r1);
+  }
+  bucketIndicesAvx2(h + i, n - i, d, out + i);
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif
+
+// Reduces with the widest kernel this CPU supports.
+inline void bucketIndices(const size_t* h, size_t n, size_t d, size_t* out) {
+  using Kernel = void (*)(const size_t*, size_t, size_t, size_t*);
+  static const Kernel kernel = []() -> Kernel {
+#ifdef HASHMAP_X86_KERNELS
+    if (__builtin_cpu_supports("avx512f")) {
+      return bucketIndicesAvx512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+      return bucketIndicesAvx2;
+    }
+#endif
+    return bucketIndicesScalar;
+  }();
+  kernel(h, n, d, out);
+}
+
+/**
+ * Recycles the coroutine frames of the lookups started for one
+ * `LookupScheduler`, so that steady-state lookups allocate nothing. Frames
+ * are kept on one free list per frame size. Frames from the heap (lookups
+ * started without a scheduler) go through the same header and are freed
+ * normally. Not thread-safe.
+ */
+class LookupFramePool {
+ private:
+  // Precedes every frame; keeps the frame at the default new alignment.
+  struct alignas(__STDCPP_DEFAULT_NEW_ALIGNMENT__) Header {
+    LookupFramePool* pool;  // nullptr for a heap frame
+    size_t size;
+  };
+
+  struct FreeFrame {
+    FreeFrame* next;
+  };
+
+  vector<pair<size_t, FreeFrame*>> freeLists;
+  size_t frames = 0;  // allocated from the heap, in use or free
+  size_t live = 0;
+  // Set when the scheduler is destroyed before some of its frames; the last
+  // frame released then deletes the pool.
+  bool orphaned = false;
+
+  FreeFrame*& freeList(size_t size) {
+    for (auto& [listSize, head] : freeLists) {
+      if (listSize == size) {
+        return head;
+      }
+    }
+    freeLists.push_back({size, nullptr});
+    return freeLists.back().second;
+  }
+
+ public:
+  LookupFramePool() = default;
+  LookupFramePool(const LookupFramePool&) = delete;
+  LookupFramePool& operator=(const LookupFramePool&) = delete;
+
+  ~LookupFramePool() {
+    for (auto& [size, head] : freeLists) {
+      while (head != nullptr) {
+        FreeFrame* next = head->next;
+        ::operator delete(reinterpret_cast<Header*>(head) - 1);
+        head = next;
+      }
+    }
+  }
+
+  /**
+   * Returns memory for a frame of `size` bytes, reusing a released frame of
+   * the same size from `pool` if there is one, or from the heap if `pool` is
+   * nullptr.
+   */
+  static void* allocate(LookupFramePool* pool, size_t size) {
+    Header* header = nullptr;
+    if (pool != nullptr) {
+      FreeFrame*& head = pool->freeList(size);
+      if (head != nullptr) {
+        header = reinterpret_cast<Header*>(head) - 1;
+        head = head->next;
+      }
+    }
+    if (header == nullptr) {
+      header = static_cast<Header*>(::operator new(sizeof(Header) + size));
+      if (pool != nullptr) {
+        pool->frames++;
+      }
+    }
+    header->pool = pool;
+    header->size = size;
+    if (pool != nullptr) {
+      pool->live++;
+    }
+    return header + 1;
+  }
+
+  /**
+   * Returns a frame from `allocate` to its pool, or to the heap.
+   */
+  static void release(void* frame) {
+    Header* header = static_cast<Header*>(frame) - 1;
+    LookupFramePool* pool = header->pool;
+    if (pool == nullptr) {
+      ::operator delete(header);
+      return;
+    }
+    FreeFrame* freed = static_cast<FreeFrame*>(frame);
+    FreeFrame*& head = pool->freeList(header->size);
+    freed->next = head;
+    head = freed;
+    if (--pool->live == 0 && pool->orphaned) {
+      delete pool;
+    }
+  }
+
+  /**
+   * Returns the number of frames allocated so far, in use or free.
+   */
+  size_t size() const {
+    return frames;
+  }
+
+  /**
+   * Called by the owner instead of deleting the pool, which outlives it
+   * until every frame has been released.
+   */
+  void close() {
+    orphaned = true;
+    if (live == 0) {
+      delete this;
+    }
+  }
+};
+
+template <typename T>
+class LookupTask;
+
+/**
+ * Round-robin scheduler that keeps up to `width` `LookupTask`s in flight.
+ * Each resume advances one lookup by a single step (one bucket or node) and
+ * prefetches the next, so while one lookup waits on memory the others make
+ * progress. Tasks may come from independent request streams; the scheduler
+ * does not own them, and each must outlive `run`.
+ *
+ * Lookups started with a scheduler (`contains_async(key, &scheduler)`) take
+ * their frames from its pool, so a caller that starts, runs and destroys
+ * lookups in batches allocates only for the first batch.
+ *
+ * Each step still costs a resume and a suspend, so this pays off only when a
+ * lookup stalls for longer than that, e.g. on string keys whose characters
+ * live on the heap. For small integer keys a plain `contains` loop, whose
+ * iterations the CPU already overlaps, is faster; `contains_many` beats both
+ * when the keys are known up front.
+ */
+class LookupScheduler {
+ private:
+  size_t width;
+  vector<coroutine_handle<>> pending;
+  vector<coroutine_handle<>> active;
+  LookupFramePool* pool;
+
+  template <typename>
+  friend class LookupTask;
+
+ public:
+  explicit LookupScheduler(size_t width = 8)
+      : width(width == 0 ? 1 : width), pool(new LookupFramePool()) {
+  }
+
+  LookupScheduler(const LookupScheduler&) = delete;
+  LookupScheduler& operator=(const LookupScheduler&) = delete;
+
+  ~LookupScheduler() {
+    pool->close();
+  }
+
+  /**
+   * Queues a lookup. A task that has already finished (or was moved from)
+   * is ignored.
+   */
+  template <typename T>
+  void submit(LookupTask<T>& task) {
+    if (task.handle && !task.handle.done()) {
+      pending.push_back(task.handle);
+    }
+  }
+
+  /**
+   * Runs every submitted lookup to completion. Skips lookups that finished
+   * after `submit` (e.g. through `get()`), and runs a lookup submitted twice
+   * only once.
+   */
+  void run() {
+    size_t next = 0;
+    // Returns the next queued lookup still to run, or nullptr.
+    auto take = [&]() -> coroutine_handle<> {
+      while (next < pending.size()) {
+        coroutine_handle<> h = pending[next++];
+        if (!h.done()) {
+          return h;
+        }
+      }
+      return nullptr;
+    };
+
+    active.clear();
+    while (active.size() < width) {
+      coroutine_handle<> h = take();
+      if (!h) {
+        break;
+      }
+      active.push_back(h);
+    }
+    while (!active.empty()) {
+      for (size_t i = 0; i < active.size();) {
+        // A task submitted twice may have finished in its other slot
+        if (!active[i].done()) {
+          active[i].resume();
+        }
+        if (!active[i].done()) {
+          i++;
+        } else if (coroutine_handle<> h = take()) {
+          active[i++] = h;
+        } else {
+          active[i] = active.back();
+          active.pop_back();
+        }
+      }
+    }
+    pending.clear();
+  }
+
+  /**
+   * Returns the number of coroutine frames the scheduler's pool holds.
+   *
+   * For autograder testing purposes only.
+   */
+  size_t get_frame_count() const {
+    return pool->size();
+  }
+};
+
+/**
+ * Lazily-started coroutine returned by `HashMap::contains_async` and
+ * `HashMap::at_async`. The lookup suspends after prefetching each bucket or
+ * chain node, so a `LookupScheduler` can overlap the cache misses of many
+ * lookups. `T` may be a reference type.
+ */
+template <typename T>
+class LookupTask {
+ public:
+  struct promise_type {
+    using Stored = conditional_t<is_reference_v<T>,
+                                 reference_wrapper<remove_reference_t<T>>, T>;
+
+    optional<Stored> result;
+    exception_ptr error;
+
+    // Called with the coroutine's arguments: `(map, key, scheduler)`
+    template <typename Map, typename Key>
+    static void* operator new(size_t size, const Map&, const Key&,
+                              LookupScheduler* scheduler) {
+      return LookupFramePool::allocate(
+          scheduler != nullptr ? scheduler->pool : nullptr, size);
+    }
+
+    static void* operator new(size_t size) {
+      return LookupFramePool::allocate(nullptr, size);
+    }
+
+    static void operator delete(void* frame) {
+      LookupFramePool::release(frame);
+    }
+
+    LookupTask get_return_object() {
+      return LookupTask(coroutine_handle<promise_type>::from_promise(*this));
+    }
+
+    suspend_always initial_suspend() noexcept {
+      return {};
+    }
+
+    suspend_always final_suspend() noexcept {
+      return {};
+    }
+
+    void return_value(T value) {
+      result.emplace(std::forward<T>(value));
+    }
+
+    void unhandled_exception() {
+      error = current_exception();
+    }
+  };
+
+ private:
+  coroutine_handle<promise_type> handle;
+
+  explicit LookupTask(coroutine_handle<promise_type> handle) : handle(handle) {
+  }
+
+  friend class LookupScheduler;
+
+ public:
+  LookupTask(LookupTask&& other) noexcept : handle(other.handle) {
+    other.handle = nullptr;
+  }
+
+  LookupTask& operator=(LookupTask&& other) noexcept {
+    if (this != &other) {
+      if (handle) {
+        handle.destroy();
+      }
+      handle = other.handle;
+      other.handle = nullptr;
+    }
+    return *this;
+  }
+
+  LookupTask(const LookupTask&) = delete;
+  LookupTask& operator=(const LookupTask&) = delete;
+
+  ~LookupTask() {
+    if (handle) {
+      handle.destroy();
+    }
+  }
+
+  /**
+   * Returns `true` once the lookup has finished.
+   */
+  bool done() const {
+    return handle.done();
+  }
+
+  /**
+   * Returns the result, running the lookup to completion first if no
+   * scheduler has. Rethrows any exception the lookup raised (e.g.
+   * `out_of_range` from `at_async`).
+   */
+  T get() {
+    while (!handle.done()) {
+      handle.resume();
+    }
+    if (handle.promise().error) {
+      rethrow_exception(handle.promise().error);
+    }
+    return std::move(*handle.promise().result);
+  }
+};
+
+template <typename KeyT>
+class HashSet;
+
+// A node of a `HashMap` chain.
+template <typename KeyT, typename ValT, bool = is_empty_v<ValT>>
+struct HashMapNode {
+  const KeyT key;
+  ValT value;
+  HashMapNode* next;
+
+  HashMapNode(KeyT key, ValT value) : key(key), value(value), next(nullptr) {
+  }
+
+  HashMapNode(KeyT key, ValT value, HashMapNode* next)
+      : key(key), value(value), next(next) {
+  }
+};
+
+// Nodes with an empty value type (as in `HashSet`) hold only the key and the
+// link. Kept to this specialization so that other nodes' layout, including
+// tail padding of the value, is unaffected.
+template <typename KeyT, typename ValT>
+struct HashMapNode<KeyT, ValT, true> {
+  const KeyT key;
+  [[no_unique_address]] ValT value;
+  HashMapNode* next;
+
+  HashMapNode(KeyT key, ValT value) : key(key), value(value), next(nullptr) {
+  }
+
+  HashMapNode(KeyT key, ValT value, HashMapNode* next)
+      : key(key), value(value), next(next) {
+  }
+};
+
 template <typename KeyT, typename ValT>
 class HashMap {
  private:
-  struct ChainNode {
-    const KeyT key;
-    ValT value;
-    ChainNode* next;
+  using ChainNode = HashMapNode<KeyT, ValT>;
+
+  // One contiguous block of node storage, filled by a copy. Nodes in it are
+  // destroyed in place and counted down in `live`; a map drops a slab whose
+  // count reached zero (see `pruneSlabs`), and the block is freed once no
+  // map or node handle refers to it.
+  struct Slab {
+    void* mem;
+    size_t bytes;
+    size_t mapped;
+    // Constructed nodes in the block, wherever they are linked now.
+    atomic<size_t> live{0};
+
+    Slab(size_t count, const MemoryPolicy& policy)
+        : bytes(count * sizeof(ChainNode)) {
+      mem = mapBucketMemory(bytes, policy, mapped);
+      if (mem == nullptr) {
+        mem = ::operator new(bytes, align_val_t(alignof(ChainNode)));
+      }
+    }
+
+    Slab(const Slab&) = delete;
+    Slab& operator=(const Slab&) = delete;
+
+    ~Slab() {
+      if (mapped != 0) {
+        unmapBucketMemory(mem, mapped);
+      } else {
+        ::operator delete(mem, align_val_t(alignof(ChainNode)));
+      }
+    }
+
+    bool holds(const ChainNode* node) const {
+      return reinterpret_cast<uintptr_t>(node) -
+                 reinterpret_cast<uintptr_t>(mem) <
+             bytes;
+    }
 
-    ChainNode(KeyT key, ValT value) : key(key), value(value), next(nullptr) {
+    ChainNode* at(size_t i) const {
+      return static_cast<ChainNode*>(mem) + i;
     }
 
-    ChainNode(KeyT key, ValT value, ChainNode* next)
-        : key(key), value(value), next(next) {
+    // Counts one node as destroyed. Returns `true` if it was the last.
+    bool release() {
+      return live.fetch_sub(1, memory_order_acq_rel) == 1;
     }
   };
 
@@ -28,18 +764,136 @@ class HashMap {
   size_t sz;
   size_t capacity;
 
+  // Slabs that may hold nodes of this map, sorted by address. Shared with
+  // other maps and node handles that nodes have moved to.
+  vector<shared_ptr<Slab>> slabs;
+
+  // Threads used by `rehash` once the table reaches
+  // `kParallelRehashMinBuckets`; 1 keeps rehashing serial.
+  size_t rehash_threads;
+  static constexpr size_t kParallelRehashMinBuckets = size_t(1) << 16;
+
+  // Optional per-bucket fingerprint filter, sized with `data`; nullptr when
+  // disabled. Each key sets two of the 16 bits of its bucket's word, so
+  // `contains`/`at` can reject most absent keys without loading the chain.
+  // Removals recompute the word of the bucket they change, so a word is
+  // always the union of the bits of the keys in its bucket.
+  uint16_t* filter;
+
+  // Backing of `data`, and the bytes mapped for it (0 if it came from
+  // operator new[]).
+  MemoryPolicy memory_policy;
+  size_t dataMapped;
+
   // Utility members for begin/next
   ChainNode* curr;
   size_t curr_idx;
 
+  // Walks and links buckets directly for the set algebra.
+  template <typename>
+  friend class HashSet;
+
   // Helper functions
 
+  // Allocates `n` buckets according to `memory_policy`. Mapped memory is
+  // always zeroed; heap memory only if `zero` is set.
+  ChainNode** allocBuckets(size_t n, size_t& mapped, bool zero = true) const {
+    void* p = mapBucketMemory(n * sizeof(ChainNode*), memory_policy, mapped);
+    if (p != nullptr) {
+      return static_cast<ChainNode**>(p);
+    }
+    return zero ? new ChainNode*[n]() : new ChainNode*[n];
+  }
+
+  static void freeBuckets(ChainNode** buckets, size_t mapped) {
+    if (mapped != 0) {
+      unmapBucketMemory(buckets, mapped);
+    } else {
+      delete[] buckets;
+    }
+  }
+
+  static bool slabBefore(const void* p, const shared_ptr<Slab>& slab) {
+    return less<const void*>()(p, slab->mem);
+  }
+
+  // Returns the entry of `slabs` holding `node`, or nullptr for a heap node.
+  // Runs in O(log S) for S slabs.
+  const shared_ptr<Slab>* slabOf(const ChainNode* node) const {
+    auto it = upper_bound(slabs.begin(), slabs.end(),
+                          static_cast<const void*>(node), slabBefore);
+    if (it == slabs.begin() || !(*--it)->holds(node)) {
+      return nullptr;
+    }
+    return &*it;
+  }
+
+  void shareSlab(const shared_ptr<Slab>& slab) {
+    auto it = lower_bound(slabs.begin(), slabs.end(), slab,
+                          [](const shared_ptr<Slab>& a,
+                             const shared_ptr<Slab>& b) {
+                            return less<const void*>()(a->mem, b->mem);
+                          });
+    if (it == slabs.end() || *it != slab) {
+      slabs.insert(it, slab);
+    }
+  }
+
+  // Drops the slabs no node lives in any more.
+  void pruneSlabs() {
+    slabs.erase(remove_if(slabs.begin(), slabs.end(),
+                          [](const shared_ptr<Slab>& slab) {
+                            return slab->live.load(memory_order_acquire) == 0;
+                          }),
+                slabs.end());
+  }
+
+  // Takes a reference on every slab of `other`, before its nodes move here.
+  void adoptSlabs(const HashMap& other) {
+    for (const shared_ptr<Slab>& slab : other.slabs) {
+      shareSlab(slab);
+    }
+    pruneSlabs();
+  }
+
+  // Frees a heap node, or destroys a slab node in place. Returns `true` if
+  // that emptied its slab; the caller should then `pruneSlabs`. Safe to
+  // call from several threads at once.
+  bool destroyNode(ChainNode* node) const {
+    const shared_ptr<Slab>* slab = slabs.empty() ? nullptr : slabOf(node);
+    if (slab == nullptr) {
+      delete node;
+      return false;
+    }
+    node->~ChainNode();
+    return (*slab)->release();
+  }
+
+  // Destroys a list of nodes linked through `next`. Returns `true` if that
+  // emptied a slab.
+  bool destroyChain(ChainNode* node) const {
+    bool emptied = false;
+    while (node != nullptr) {
+      ChainNode* nextNode = node->next;
+      emptied |= destroyNode(node);
+      node = nextNode;
+    }
+    return emptied;
+  }
+
+  // Constructs a copy of `src`, unlinked, in the raw storage at `dst`.
+  static void cloneNode(ChainNode* dst, const ChainNode* src) {
+    if constexpr (is_trivially_copyable_v<ChainNode>) {
+      memcpy(static_cast<void*>(dst), src, sizeof(ChainNode));
+      dst->next = nullptr;
+    } else {
+      new (dst) ChainNode(src->key, src->value);
+    }
+  }
+
   void initBuckets(size_t cap) {
     capacity = cap;
-    data = new ChainNode*[capacity];
-    for (size_t i = 0; i < capacity; i++) {
-      data[i] = nullptr;
-    }
+    data = allocBuckets(capacity, dataMapped);
   }
 
   void freeNodes() {
@@ -48,31 +902,117 @@ class HashMap {
       ChainNode* node = data[i];
       while (node != nullptr) {
         ChainNode* nextNode = node->next;
-        delete node;
+        destroyNode(node);
         node = nextNode;
       }
       data[i] = nullptr;
     }
+    if (filter != nullptr) {
+      memset(filter, 0, capacity * sizeof(uint16_t));
+    }
+    slabs.clear();
     sz = 0;
   }
 
+  // Copies the chains (and filter) of `other` into this map's buckets,
+  // which must be empty and of the same capacity, preserving chain order.
+  // Nodes are rebuilt in place from `spare` (a list linked through `next`)
+  // first; the rest come from one new slab. Unused spares are destroyed.
+  void copyNodes(const HashMap& other, ChainNode* spare, size_t spareCount) {
+    if (other.filter != nullptr) {
+      if (filter == nullptr) {
+        filter = new uint16_t[capacity];
+      }
+      memcpy(filter, other.filter, capacity * sizeof(uint16_t));
+    }
+
+    ChainNode* block = nullptr;
+    Slab* fresh = nullptr;
+    if (other.sz > spareCount) {
+      shared_ptr<Slab> slab =
+          make_shared<Slab>(other.sz - spareCount, memory_policy);
+      fresh = slab.get();
+      block = slab->at(0);
+      shareSlab(slab);
+    }
+
+    try {
+      for (size_t i = 0; i < other.capacity; i++) {
+        ChainNode** tailPtr = &data[i];
+        for (ChainNode* src = other.data[i]; src != nullptr; src = src->next) {
+          ChainNode* node;
+          if (spare != nullptr) {
+            node = spare;
+            spare = spare->next;
+            node->~ChainNode();
+            try {
+              cloneNode(node, src);
+            } catch (...) {
+              // The storage holds no object now; release it without one
+              const shared_ptr<Slab>* slab = slabOf(node);
+              if (slab != nullptr) {
+                (*slab)->release();
+              } else if constexpr (alignof(ChainNode) >
+                                   __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+                ::operator delete(node, align_val_t(alignof(ChainNode)));
+              } else {
+                ::operator delete(node);
+              }
+              throw;
+            }
+          } else {
+            node = block;
+            cloneNode(node, src);
+            fresh->live.fetch_add(1, memory_order_relaxed);
+            block++;
+          }
+          *tailPtr = node;
+          tailPtr = &node->next;
+          sz++;
+        }
+      }
+    } catch (...) {
+      destroyChain(spare);
+      pruneSlabs();
+      throw;
+    }
+    destroyChain(spare);
+    pruneSlabs();
+  }
+
   void rehash(size_t newCapacity) {
+    rehash(newCapacity, rehash_threads);
+  }
+
+  // Rehashes with up to `threads` threads, but serially below
+  // `kParallelRehashMinBuckets`, where threads cost more than they save.
+  void rehash(size_t newCapacity, size_t threads) {
     if (newCapacity == 0) {
       newCapacity = 1;
     }
 
-    ChainNode** newData = new ChainNode*[newCapacity];
-    for (size_t i = 0; i < newCapacity; i++) {
-      newData[i] = nullptr;
+    if (threads > 1 &&
+        max(capacity, newCapacity) >= kParallelRehashMinBuckets) {
+      parallelRehash(newCapacity, threads);
+      return;
     }
 
+    size_t newMapped;
+    ChainNode** newData = allocBuckets(newCapacity, newMapped);
+    uint16_t* newFilter =
+        filter != nullptr ? new uint16_t[newCapacity]() : nullptr;
+
     // Move existing nodes into new table, no new nodes created
     for (size_t i = 0; i < capacity; i++) {
       ChainNode* node = data[i];
       while (node != nullptr) {
         ChainNode* nextNode = node->next;
 
-        size_t idx = std::hash<KeyT>()(node->key) % newCapacity;
+        size_t h = hashOf(node->key);
+        size_t idx = h % newCapacity;
+        if (newFilter != nullptr) {
+          newFilter[idx] |= fingerprint(h);
+        }
 
         // INSERT AT TAIL to preserve ordering
         if (newData[idx] == nullptr) {
@@ -90,17 +1030,360 @@ class HashMap {
       data[i] = nullptr;
     }
 
-    delete[] data;
+    freeBuckets(data, dataMapped);
     data = newData;
+    dataMapped = newMapped;
+    delete[] filter;
+    filter = newFilter;
     capacity = newCapacity;
   }
 
+  size_t hashOf(const KeyT& key) const {
+    return std::hash<KeyT>()(key);
+  }
+
   // Central helper for computing the bucket index for a key
   size_t bucketIndex(const KeyT& key) const {
-    return std::hash<KeyT>()(key) % capacity;
+    return hashOf(key) % capacity;
+  }
+
+  static uint16_t fingerprint(size_t h) {
+    // Mix so the bits don't repeat the ones that chose the bucket (integer
+    // hashes are often the identity).
+    uint64_t m = static_cast<uint64_t>(h) * 0x9E3779B97F4A7C15ull;
+    return static_cast<uint16_t>((1u << (m >> 60)) | (1u << ((m >> 56) & 15)));
+  }
+
+  // Returns `false` only if no key with hash `h` is in bucket `idx`.
+  bool mayContain(size_t idx, size_t h) const {
+    if (filter == nullptr) {
+      return true;
+    }
+    uint16_t fp = fingerprint(h);
+    return (filter[idx] & fp) == fp;
+  }
+
+  void filterAdd(size_t idx, size_t h) {
+    if (filter != nullptr) {
+      filter[idx] |= fingerprint(h);
+    }
+  }
+
+  // Recomputes the filter word of bucket `idx` from its chain, clearing the
+  // bits of keys that have left it.
+  void filterRefresh(size_t idx) {
+    if (filter == nullptr) {
+      return;
+    }
+    uint16_t bits = 0;
+    for (ChainNode* node = data[idx]; node != nullptr; node = node->next) {
+      bits |= fingerprint(hashOf(node->key));
+    }
+    filter[idx] = bits;
+  }
+
+  // Runs `fn(t)` for every t in [0, threads), using the calling thread for
+  // the last one and for any thread that cannot be started. Its buffers are
+  // allocated up front, so `run` throws only what `fn` throws.
+  class TaskRunner {
+   private:
+    vector<exception_ptr> errors;
+    vector<thread> workers;
+
+   public:
+    explicit TaskRunner(size_t threads) : errors(threads) {
+      workers.reserve(threads - 1);
+    }
+
+    // Rethrows the first exception after all threads join.
+    template <typename Fn>
+    void run(Fn fn) {
+      size_t threads = errors.size();
+      fill(errors.begin(), errors.end(), nullptr);
+      auto task = [&](size_t t) {
+        try {
+          fn(t);
+        } catch (...) {
+          errors[t] = current_exception();
+        }
+      };
+
+      size_t started = 0;
+      try {
+        for (; started + 1 < threads; started++) {
+          workers.emplace_back(task, started);
+        }
+      } catch (...) {
+        // Out of threads: the rest run here
+      }
+      for (size_t t = started; t < threads; t++) {
+        task(t);
+      }
+      for (thread& w : workers) {
+        w.join();
+      }
+      workers.clear();
+
+      for (exception_ptr& e : errors) {
+        if (e) {
+          rethrow_exception(e);
+        }
+      }
+    }
+  };
+
+  template <typename Fn>
+  static void runParallel(size_t threads, Fn fn) {
+    TaskRunner(threads).run(fn);
+  }
+
+  // Adds the per-thread counts of nodes linked by a parallel build or merge.
+  void addCounts(const vector<size_t>& added) {
+    for (size_t count : added) {
+      sz += count;
+    }
+  }
+
+  // Start of part `p` when [0, n) is split into `parts` near-equal ranges.
+  static size_t sliceStart(size_t n, size_t parts, size_t p) {
+    return n / parts * p + min(p, n % parts);
+  }
+
+  // Splits the bucket array into chunks handed out dynamically to `threads`
+  // workers, so a few long chains or dense regions don't stall one thread.
+  // Calls `body(lo, hi, chunk)` for each chunk's bucket range [lo, hi).
+  static constexpr size_t kChunksPerThread = 8;
+
+  size_t chunkCount(size_t threads) const {
+    return max<size_t>(1, min(capacity, threads * kChunksPerThread));
+  }
+
+  template <typename Body>
+  void forEachChunk(size_t threads, Body body) const {
+    size_t chunks = chunkCount(threads);
+    atomic<size_t> nextChunk{0};
+    runParallel(min(threads, chunks), [&](size_t) {
+      for (size_t c = nextChunk.fetch_add(1); c < chunks;
+           c = nextChunk.fetch_add(1)) {
+        body(sliceStart(capacity, chunks, c),
+             sliceStart(capacity, chunks, c + 1), c);
+      }
+    });
+  }
+
+  // Grows the table, doubling as `insert` would, until `count` mappings fit
+  // without exceeding a load factor of 1.5.
+  void growFor(size_t count, size_t threads) {
+    size_t newCapacity = capacity == 0 ? 1 : capacity;
+    while (2 * count > 3 * newCapacity) {  // int-only check for > 1.5
+      newCapacity *= 2;
+    }
+    if (newCapacity != capacity) {
+      rehash(newCapacity, threads);
+    }
+  }
+
+  // Returns the node holding `key` in bucket `idx`, or nullptr.
+  ChainNode* findNode(const KeyT& key, size_t idx) const {
+    ChainNode* node = data[idx];
+    while (node != nullptr && !(node->key == key)) {
+      node = node->next;
+    }
+    return node;
+  }
+
+  // Keys per block in the batch operations.
+  static constexpr size_t kBatch = 256;
+
+  // Fills `hashes` and `idx` for `n` keys, `keyOf(i)` giving the i-th.
+  // Hashing is a plain loop (vectorized by the compiler for integer keys);
+  // the reduction uses the SIMD `bucketIndices` kernels.
+  template <typename KeyOf>
+  void indexBatch(KeyOf keyOf, size_t n, size_t* hashes, size_t* idx) const {
+    for (size_t i = 0; i < n; i++) {
+      hashes[i] = hashOf(keyOf(i));
+    }
+    bucketIndices(hashes, n, capacity, idx);
+  }
+
+  // Detaches every node from the table without freeing it. The caller must
+  // already have adopted this map's slabs.
+  void detachAll() {
+    for (size_t i = 0; i < capacity; i++) {
+      data[i] = nullptr;
+    }
+    slabs.clear();
+    if (filter != nullptr) {
+      memset(filter, 0, capacity * sizeof(uint16_t));
+    }
+    sz = 0;
+    curr = nullptr;
+    curr_idx = 0;
+  }
+
+  // Rehash in two parallel steps: each thread unlinks the nodes of its slice
+  // of the old table into one list per destination range, reusing their
+  // `next` links, then each thread links the lists bound for its own range
+  // of the new table. Destination ranges are disjoint, so the link step
+  // needs no synchronization. Chains keep the same order as a serial rehash.
+  // Everything is allocated before the first node moves, so a failed
+  // allocation leaves the table as it was.
+  void parallelRehash(size_t newCapacity, size_t threads) {
+    size_t width = (newCapacity + threads - 1) / threads;
+
+    // routes[s * threads + p] is the {head, tail} of the nodes from source
+    // slice s headed to destination range p, in source order.
+    vector<pair<ChainNode*, ChainNode*>> routes(threads * threads);
+    TaskRunner runner(threads);
+
+    // Zeroed by the link step, so first touch is spread over threads
+    size_t newMapped;
+    ChainNode** newData = allocBuckets(newCapacity, newMapped, false);
+    uint16_t* newFilter;
+    try {
+      newFilter = filter != nullptr ? new uint16_t[newCapacity] : nullptr;
+    } catch (...) {
+      freeBuckets(newData, newMapped);
+      throw;
+    }
+
+    runner.run([&](size_t s) {
+      pair<ChainNode*, ChainNode*>* route = &routes[s * threads];
+      size_t hi = sliceStart(capacity, threads, s + 1);
+      for (size_t i = sliceStart(capacity, threads, s); i < hi; i++) {
+        ChainNode* node = data[i];
+        while (node != nullptr) {
+          ChainNode* nextNode = node->next;
+          auto& [head, tail] = route[hashOf(node->key) % newCapacity / width];
+          (head == nullptr ? head : tail->next) = node;
+          tail = node;
+          node->next = nullptr;
+          node = nextNode;
+        }
+      }
+    });
+
+    runner.run([&](size_t p) {
+      size_t lo = min(p * width, newCapacity);
+      size_t hi = min(lo + width, newCapacity);
+      fill(newData + lo, newData + hi, nullptr);
+      if (newFilter != nullptr) {
+        fill(newFilter + lo, newFilter + hi, 0);
+      }
+
+      for (size_t s = 0; s < threads; s++) {
+        ChainNode* node = routes[s * threads + p].first;
+        while (node != nullptr) {
+          ChainNode* nextNode = node->next;
+          size_t h = hashOf(node->key);
+          size_t idx = h % newCapacity;
+
+          // INSERT AT TAIL to preserve ordering
+          ChainNode** link = &newData[idx];
+          while (*link != nullptr) {
+            link = &(*link)->next;
+          }
+          *link = node;
+          node->next = nullptr;
+          if (newFilter != nullptr) {
+            newFilter[idx] |= fingerprint(h);
+          }
+          node = nextNode;
+        }
+      }
+    });
+
+    freeBuckets(data, dataMapped);
+    data = newData;
+    dataMapped = newMapped;
+    delete[] filter;
+    filter = newFilter;
+    capacity = newCapacity;
   }
 
  public:
+  /**
+   * Owning handle to a single mapping detached from a `HashMap`, in the style
+   * of C++17 node handles. Obtained from `extract` and consumed by
+   * `insert(node_type&&)`; moving an entry between maps this way allocates
+   * nothing and copies neither key nor value. Frees the mapping if destroyed
+   * while still holding it.
+   */
+  class node_type {
+   private:
+    ChainNode* node;
+    // Keeps the block alive if the node was carved from a copy's slab.
+    shared_ptr<Slab> slab;
+
+    node_type(ChainNode* node, shared_ptr<Slab> slab)
+        : node(node), slab(std::move(slab)) {
+    }
+
+    void reset() {
+      if (node != nullptr && slab != nullptr) {
+        node->~ChainNode();
+        slab->release();
+      } else {
+        delete node;
+      }
+      node = nullptr;
+      slab.reset();
+    }
+
+    friend class HashMap;
+
+   public:
+    node_type() : node(nullptr) {
+    }
+
+    node_type(node_type&& other) noexcept
+        : node(other.node), slab(std::move(other.slab)) {
+      other.node = nullptr;
+    }
+
+    node_type& operator=(node_type&& other) noexcept {
+      if (this != &other) {
+        reset();
+        node = other.node;
+        slab = std::move(other.slab);
+        other.node = nullptr;
+      }
+      return *this;
+    }
+
+    node_type(const node_type&) = delete;
+    node_type& operator=(const node_type&) = delete;
+
+    ~node_type() {
+      reset();
+    }
+
+    /**
+     * Returns `true` if the handle holds no mapping.
+     */
+    bool empty() const {
+      return node == nullptr;
+    }
+
+    explicit operator bool() const {
+      return node != nullptr;
+    }
+
+    /**
+     * Returns the key of the held mapping. The handle must not be empty.
+     */
+    const KeyT& key() const {
+      return node->key;
+    }
+
+    /**
+     * Returns the value of the held mapping. The handle must not be empty.
+     */
+    ValT& mapped() const {
+      return node->value;
+    }
+  };
+
   /**
    * Creates an empty `HashMap` with 10 buckets.
    */
@@ -108,6 +1391,9 @@ class HashMap {
     sz = 0;
     curr = nullptr;
     curr_idx = 0;
+    rehash_threads = 1;
+    filter = nullptr;
+    dataMapped = 0;
     initBuckets(10);
   }
 
@@ -118,6 +1404,9 @@ class HashMap {
     sz = 0;
     curr = nullptr;
     curr_idx = 0;
+    rehash_threads = 1;
+    filter = nullptr;
+    dataMapped = 0;
     if (capacity == 0) {
       initBuckets(1);
     } else {
@@ -161,7 +1450,8 @@ class HashMap {
       rehash(capacity * 2);
     }
 
-    size_t idx = bucketIndex(key);  // use helper function
+    size_t h = hashOf(key);
+    size_t idx = h % capacity;
     ChainNode* node = data[idx];
 
     // If key already exists, do not update mapping
@@ -175,9 +1465,397 @@ class HashMap {
     // Create exactly one new node and insert at head of chain
     ChainNode* newNode = new ChainNode(key, value, data[idx]);
     data[idx] = newNode;
+    filterAdd(idx, h);
     sz++;
   }
 
+  /**
+   * Adds every `{key, value}` pair from `range`, a random-access range of
+   * pairs (e.g. `vector<pair<KeyT, ValT>>`), using `threads` threads. As with
+   * `insert`, existing keys are not updated, and the first occurrence of a
+   * key within `range` wins.
+   *
+   * Grows the table once up front so that every element could fit without
+   * exceeding a load factor of 1.5, then partitions the elements by bucket
+   * range so that each thread links its own chains with no synchronization.
+   *
+   * Runs in O((N + B) / T + L) on T threads, where N is the size of `range`.
+   */
+  template <typename Range>
+  void build_parallel(const Range& range, size_t threads) {
+    auto first = std::begin(range);
+    size_t n = static_cast<size_t>(std::distance(first, std::end(range)));
+    if (threads == 0) {
+      threads = 1;
+    }
+    if (n == 0) {
+      return;
+    }
+
+    growFor(sz + n, threads);
+
+    size_t width = (capacity + threads - 1) / threads;
+
+    // routed[s][p] holds {element, hash} from input slice s headed to
+    // bucket range p, in input order.
+    vector<vector<vector<pair<size_t, size_t>>>> routed(
+        threads, vector<vector<pair<size_t, size_t>>>(threads));
+
+    runParallel(threads, [&](size_t s) {
+      size_t hi = sliceStart(n, threads, s + 1);
+      for (size_t i = sliceStart(n, threads, s); i < hi; i++) {
+        size_t h = hashOf(first[i].first);
+        routed[s][h % capacity / width].push_back({i, h});
+      }
+    });
+
+    vector<size_t> added(threads, 0);
+    try {
+      runParallel(threads, [&](size_t p) {
+        for (size_t s = 0; s < threads; s++) {
+          for (const pair<size_t, size_t>& r : routed[s][p]) {
+            const auto& element = first[r.first];
+            size_t idx = r.second % capacity;
+            if (findNode(element.first, idx) == nullptr) {
+              data[idx] =
+                  new ChainNode(element.first, element.second, data[idx]);
+              filterAdd(idx, r.second);
+              added[p]++;
+            }
+          }
+        }
+      });
+    } catch (...) {
+      // Nodes linked before the failure stay in the table
+      addCounts(added);
+      throw;
+    }
+    addCounts(added);
+  }
+
+  /**
+   * Adds every `{key, value}` pair from `range`, a random-access range of
+   * pairs. Same result as calling `insert` on each element in order.
+   *
+   * Hashes and reduces keys to bucket indices in blocks with the SIMD
+   * kernels, prefetching buckets ahead of the chain walks. Grows exactly as
+   * `insert` does, so duplicate keys in `range` do not over-size the table.
+   *
+   * Runs in amortized O(N * L), where N is the size of `range`.
+   */
+  template <typename Range>
+  void insert_range(const Range& range) {
+    auto first = std::begin(range);
+    size_t n = static_cast<size_t>(std::distance(first, std::end(range)));
+    if (n == 0) {
+      return;
+    }
+    if (capacity == 0) {
+      rehash(1);
+    }
+
+    size_t hashes[kBatch];
+    size_t idx[kBatch];
+    for (size_t base = 0; base < n; base += kBatch) {
+      size_t count = min(kBatch, n - base);
+      indexBatch([&](size_t i) -> const KeyT& { return first[base + i].first; },
+                 count, hashes, idx);
+      for (size_t i = 0; i < count; i++) {
+        __builtin_prefetch(&data[idx[i]]);
+      }
+      for (size_t i = 0; i < count; i++) {
+        if (2 * (sz + 1) > 3 * capacity) {  // int-only check for > 1.5
+          growFor(sz + 1, rehash_threads);
+          bucketIndices(hashes + i, count - i, capacity, idx + i);
+        }
+        const auto& element = first[base + i];
+        if (findNode(element.first, idx[i]) == nullptr) {
+          data[idx[i]] =
+              new ChainNode(element.first, element.second, data[idx[i]]);
+          filterAdd(idx[i], hashes[i]);
+          sz++;
+        }
+      }
+    }
+  }
+
+  /**
+   * Returns, for each key in `keys` (a random-access range), 1 if it is
+   * present and 0 if not. Faster than calling `contains` in a loop once the
+   * table outgrows the cache: keys are hashed and reduced in blocks with the
+   * SIMD kernels, and each lookup prefetches its bucket and then its chain
+   * head a few keys ahead, so the cache misses of neighbouring keys overlap.
+   *
+   * Runs in O(N * L), where N is the size of `keys`.
+   */
+  template <typename Range>
+  vector<uint8_t> contains_many(const Range& keys) const {
+    auto first = std::begin(keys);
+    size_t n = static_cast<size_t>(std::distance(first, std::end(keys)));
+    vector<uint8_t> found(n, 0);
+    if (capacity == 0) {
+      return found;
+    }
+
+    // Keys between a bucket's prefetch and its load, and again between a
+    // head's prefetch and the chain walk
+    constexpr size_t kAhead = 16;
+    size_t hashes[kBatch];
+    size_t idx[kBatch];
+    ChainNode* heads[kBatch];
+    for (size_t base = 0; base < n; base += kBatch) {
+      size_t count = min(kBatch, n - base);
+      indexBatch([&](size_t i) -> const KeyT& { return first[base + i]; },
+                 count, hashes, idx);
+      for (size_t i = 0; i < count + 2 * kAhead; i++) {
+        if (i < count) {
+          __builtin_prefetch(&data[idx[i]]);
+          if (filter != nullptr) {
+            __builtin_prefetch(&filter[idx[i]]);
+          }
+        }
+        if (i >= kAhead && i - kAhead < count) {
+          size_t j = i - kAhead;
+          heads[j] = mayContain(idx[j], hashes[j]) ? data[idx[j]] : nullptr;
+          if (heads[j] != nullptr) {
+            __builtin_prefetch(heads[j]);
+          }
+        }
+        if (i >= 2 * kAhead) {
+          size_t j = i - 2 * kAhead;
+          ChainNode* node = heads[j];
+          while (node != nullptr && !(node->key == first[base + j])) {
+            node = node->next;
+          }
+          found[base + j] = node != nullptr;
+        }
+      }
+    }
+    return found;
+  }
+
+  /**
+   * Moves every mapping of `other` into `this`, leaving `other` empty. Nodes
+   * for keys new to `this` are relinked, not copied or reallocated. For keys
+   * present in both, the value becomes `combine_fn(mine, theirs)` and the
+   * node from `other` is freed.
+   *
+   * Grows by doubling when the load factor exceeds 1.5, as `insert` does.
+   * If `combine_fn` throws, the mappings not merged yet stay in `other`.
+   *
+   * Runs in O(N2 * L + B2), where N2 and B2 are the number of mappings and
+   * buckets in `other`.
+   */
+  template <typename CombineFn>
+  void merge(HashMap& other, CombineFn combine_fn) {
+    if (this == &other) {
+      return;
+    }
+    adoptSlabs(other);
+    other.curr = nullptr;
+    other.curr_idx = 0;
+
+    for (size_t i = 0; i < other.capacity; i++) {
+      // Detach the chain first, so every node has exactly one owner
+      ChainNode* node = other.data[i];
+      other.data[i] = nullptr;
+      try {
+        while (node != nullptr) {
+          ChainNode* nextNode = node->next;
+
+          if (2 * (sz + 1) > 3 * capacity) {  // int-only check for > 1.5
+            rehash(capacity * 2);
+          }
+          size_t h = hashOf(node->key);
+          size_t idx = h % capacity;
+          ChainNode* existing = findNode(node->key, idx);
+          if (existing != nullptr) {
+            existing->value = combine_fn(existing->value, node->value);
+            if (destroyNode(node)) {
+              pruneSlabs();
+            }
+          } else {
+            node->next = data[idx];
+            data[idx] = node;
+            filterAdd(idx, h);
+            sz++;
+          }
+          other.sz--;
+
+          node = nextNode;
+        }
+      } catch (...) {
+        // `node` and the rest of its chain are still unmerged
+        other.data[i] = node;
+        other.filterRefresh(i);
+        throw;
+      }
+    }
+    other.detachAll();
+  }
+
+  /**
+   * Merges every map in `sources` into `this` using `threads` threads,
+   * leaving the sources empty. Behaves like calling `merge` on each source in
+   * order: nodes for new keys are relinked, and duplicate keys are combined
+   * as `combine_fn(mine, theirs)` in source order.
+   *
+   * Grows the table up front for the largest of the maps, then partitions
+   * all source nodes by destination bucket range so that each thread links
+   * and combines its own range with no synchronization. Keys shared between
+   * sources take no extra buckets: the table grows again only if the merged
+   * size exceeds a load factor of 1.5, as with `insert`. `sources` must not
+   * contain `this` or the same map twice.
+   *
+   * If `combine_fn` throws, the sources are left empty and the mappings of
+   * the failing thread's range that were not merged yet are destroyed.
+   *
+   * Runs in O((N + B) / T + L) on T threads, where N and B are the total
+   * mappings and buckets across all maps.
+   */
+  template <typename CombineFn>
+  void merge_parallel(const vector<HashMap*>& sources, CombineFn combine_fn,
+                      size_t threads) {
+    if (threads == 0) {
+      threads = 1;
+    }
+
+    // Overlapping keys make the sum of the sizes a large overestimate
+    size_t largest = sz;
+    for (HashMap* src : sources) {
+      largest = max(largest, src->sz);
+      adoptSlabs(*src);
+    }
+    growFor(largest, threads);
+
+    size_t width = (capacity + threads - 1) / threads;
+
+    // routed[k * threads + s][p] holds {node, hash} from slice s of source
+    // k headed to bucket range p, in source order.
+    vector<vector<vector<pair<ChainNode*, size_t>>>> routed(
+        sources.size() * threads,
+        vector<vector<pair<ChainNode*, size_t>>>(threads));
+
+    runParallel(threads, [&](size_t s) {
+      for (size_t k = 0; k < sources.size(); k++) {
+        HashMap& src = *sources[k];
+        size_t hi = sliceStart(src.capacity, threads, s + 1);
+        for (size_t i = sliceStart(src.capacity, threads, s); i < hi; i++) {
+          for (ChainNode* node = src.data[i]; node != nullptr;
+               node = node->next) {
+            size_t h = hashOf(node->key);
+            routed[k * threads + s][h % capacity / width].push_back({node, h});
+          }
+        }
+      }
+    });
+
+    // From here on the routing lists own the source nodes
+    for (HashMap* src : sources) {
+      src->detachAll();
+    }
+
+    vector<size_t> added(threads, 0);
+    try {
+      runParallel(threads, [&](size_t p) {
+        size_t f = 0;
+        size_t j = 0;
+        try {
+          for (; f < routed.size(); f++) {
+            const vector<pair<ChainNode*, size_t>>& part = routed[f][p];
+            for (j = 0; j < part.size(); j++) {
+              ChainNode* node = part[j].first;
+              size_t idx = part[j].second % capacity;
+              ChainNode* existing = findNode(node->key, idx);
+              if (existing != nullptr) {
+                existing->value = combine_fn(existing->value, node->value);
+                destroyNode(node);
+              } else {
+                node->next = data[idx];
+                data[idx] = node;
+                filterAdd(idx, part[j].second);
+                added[p]++;
+              }
+            }
+          }
+        } catch (...) {
+          // The failed node and the rest of this range belong to no map
+          for (; f < routed.size(); f++, j = 0) {
+            for (; j < routed[f][p].size(); j++) {
+              destroyNode(routed[f][p][j].first);
+            }
+          }
+          throw;
+        }
+      });
+    } catch (...) {
+      addCounts(added);
+      pruneSlabs();
+      throw;
+    }
+    addCounts(added);
+    pruneSlabs();
+    growFor(sz, threads);
+  }
+
+  /**
+   * Enables or disables the per-bucket fingerprint filter. When enabled,
+   * `contains` and `at` reject most absent keys after reading one 16-bit word
+   * instead of loading the chain, at a cost of 2 bytes per bucket. The
+   * filter is rebuilt on every rehash.
+   *
+   * Runs in O(N+B) when enabling, and O(1) otherwise.
+   */
+  void set_filter(bool enabled) {
+    if (!enabled) {
+      delete[] filter;
+      filter = nullptr;
+      return;
+    }
+    if (filter != nullptr) {
+      return;
+    }
+
+    filter = new uint16_t[capacity]();
+    for (size_t i = 0; i < capacity; i++) {
+      filterRefresh(i);
+    }
+  }
+
+  /**
+   * Returns `true` if the fingerprint filter is enabled.
+   */
+  bool filter_enabled() const {
+    return filter != nullptr;
+  }
+
+  /**
+   * Sets the number of threads `rehash` uses once the table has at least
+   * 65536 buckets. The default, 1, keeps rehashing serial.
+   */
+  void set_rehash_threads(size_t threads) {
+    rehash_threads = threads == 0 ? 1 : threads;
+  }
+
+  /**
+   * Sets how the bucket array is backed (huge pages, NUMA placement) and
+   * moves the current buckets to an array allocated under it. Later resizes
+   * and copies use the same policy.
+   *
+   * Runs in O(N+B).
+   */
+  void set_memory_policy(const MemoryPolicy& policy) {
+    memory_policy = policy;
+    rehash(capacity);
+  }
+
+  /**
+   * Returns the policy set by `set_memory_policy`.
+   */
+  const MemoryPolicy& get_memory_policy() const {
+    return memory_policy;
+  }
+
   /**
    * Return a reference to the value stored for `key` in the map.
    *
@@ -185,43 +1863,134 @@ class HashMap {
    *
    * Runs in O(L), where L is the length of the longest chain.
    */
-  ValT& at(const KeyT& key) const {
-    // TODO_STUDENT
+  ValT& at(const KeyT& key) const {
+    // TODO_STUDENT
+    if (capacity == 0) {
+      throw out_of_range("Key not found");
+    }
+
+    size_t h = hashOf(key);
+    size_t idx = h % capacity;
+    if (!mayContain(idx, h)) {
+      throw out_of_range("Key not found");
+    }
+    ChainNode* node = data[idx];
+    while (node != nullptr) {
+      if (node->key == key) {
+        return node->value;
+      }
+      node = node->next;
+    }
+    throw out_of_range("Key not found");
+  }
+
+  /**
+   * Returns `true` if the key is present in the map, and false otherwise.
+   *
+   * Runs in O(L), where L is the length of the longest chain.
+   */
+  bool contains(const KeyT& key) const {
+    if (capacity == 0) {
+      return false;
+    }
+
+    size_t h = hashOf(key);
+    size_t idx = h % capacity;
+    if (!mayContain(idx, h)) {
+      return false;
+    }
+    ChainNode* node = data[idx];
+    while (node != nullptr) {
+      if (node->key == key) {
+        return true;
+      }
+      node = node->next;
+    }
+    return false;
+  }
+
+// GCC 12 flags the frames allocated by the promise's placement `operator
+// new` as freed by the wrong `operator delete`; the standard requires the
+// usual one, and both go through `LookupFramePool`.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+  /**
+   * Coroutine version of `contains`, to be run by a `LookupScheduler` (or
+   * `get()`). Prefetches the bucket and then each chain node, suspending
+   * before dereferencing it. The map must not be modified while the lookup is
+   * in flight.
+   *
+   * The frame comes from `scheduler`'s pool if one is given (the task may
+   * outlive the scheduler), and from the heap otherwise. Takes `key` by
+   * value because the lookup outlives the call.
+   */
+  LookupTask<bool> contains_async(KeyT key,
+                                  LookupScheduler* scheduler = nullptr) const {
+    (void)scheduler;  // read by the promise's operator new
     if (capacity == 0) {
-      throw out_of_range("Key not found");
+      co_return false;
     }
 
-    size_t idx = bucketIndex(key);
-    ChainNode* node = data[idx];
-    while (node != nullptr) {
+    size_t h = hashOf(key);
+    size_t idx = h % capacity;
+    if (filter != nullptr) {
+      __builtin_prefetch(&filter[idx]);
+      co_await suspend_always{};
+      if (!mayContain(idx, h)) {
+        co_return false;
+      }
+    }
+
+    __builtin_prefetch(&data[idx]);
+    co_await suspend_always{};
+    for (ChainNode* node = data[idx]; node != nullptr; node = node->next) {
+      __builtin_prefetch(node);
+      co_await suspend_always{};
       if (node->key == key) {
-        return node->value;
+        co_return true;
       }
-      node = node->next;
     }
-    throw out_of_range("Key not found");
+    co_return false;
   }
 
   /**
-   * Returns `true` if the key is present in the map, and false otherwise.
-   *
-   * Runs in O(L), where L is the length of the longest chain.
+   * Coroutine version of `at`; see `contains_async`. The task's `get()`
+   * returns a reference to the stored value, or throws `out_of_range` if the
+   * key is not present.
    */
-  bool contains(const KeyT& key) const {
+  LookupTask<ValT&> at_async(KeyT key,
+                            LookupScheduler* scheduler = nullptr) const {
+    (void)scheduler;  // read by the promise's operator new
     if (capacity == 0) {
-      return false;
+      throw out_of_range("Key not found");
     }
 
-    size_t idx = bucketIndex(key);
-    ChainNode* node = data[idx];
-    while (node != nullptr) {
+    size_t h = hashOf(key);
+    size_t idx = h % capacity;
+    if (filter != nullptr) {
+      __builtin_prefetch(&filter[idx]);
+      co_await suspend_always{};
+      if (!mayContain(idx, h)) {
+        throw out_of_range("Key not found");
+      }
+    }
+
+    __builtin_prefetch(&data[idx]);
+    co_await suspend_always{};
+    for (ChainNode* node = data[idx]; node != nullptr; node = node->next) {
+      __builtin_prefetch(node);
+      co_await suspend_always{};
       if (node->key == key) {
-        return true;
+        co_return node->value;
       }
-      node = node->next;
     }
-    return false;
+    throw out_of_range("Key not found");
   }
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
 
   /**
    * Empties the `HashMap`, freeing all nodes. The bucket array may be left
@@ -246,8 +2015,10 @@ class HashMap {
   ~HashMap() {
     // TODO_STUDENT
     freeNodes();
-    delete[] data;
+    freeBuckets(data, dataMapped);
     data = nullptr;
+    delete[] filter;
+    filter = nullptr;
     capacity = 0;
     curr = nullptr;
     curr_idx = 0;
@@ -288,16 +2059,217 @@ class HashMap {
       prev->next = node->next;
     }
 
+    filterRefresh(idx);
+
     ValT removedValue = node->value;
-    delete node;
+    if (destroyNode(node)) {
+      pruneSlabs();
+    }
     sz--;
     return removedValue;
   }
 
+  /**
+   * Removes every mapping for which `pred(key, value)` returns `true`, and
+   * returns the number removed. Each chain is walked once and matching
+   * nodes are unlinked and freed in place; no value is copied. The bucket
+   * array keeps its size; call `shrink_to_fit` afterwards to release it.
+   *
+   * Resets the `begin`/`next` state.
+   *
+   * Runs in O(N+B).
+   */
+  template <typename Pred>
+  size_t erase_if(Pred pred) {
+    size_t removed = 0;
+    bool emptied = false;
+    for (size_t i = 0; i < capacity; i++) {
+      size_t before = removed;
+      ChainNode** link = &data[i];
+      while (*link != nullptr) {
+        ChainNode* node = *link;
+        const KeyT& key = node->key;
+        const ValT& value = node->value;
+        if (pred(key, value)) {
+          *link = node->next;
+          emptied |= destroyNode(node);
+          sz--;
+          removed++;
+        } else {
+          link = &node->next;
+        }
+      }
+      if (removed != before) {
+        filterRefresh(i);
+      }
+    }
+    if (emptied) {
+      pruneSlabs();
+    }
+    curr = nullptr;
+    curr_idx = 0;
+    return removed;
+  }
+
+  /**
+   * Keeps only the mappings for which `pred(key, value)` returns `true`, and
+   * returns the number removed. See `erase_if`.
+   *
+   * Runs in O(N+B).
+   */
+  template <typename Pred>
+  size_t retain(Pred pred) {
+    return erase_if([&pred](const KeyT& key, const ValT& value) {
+      return !pred(key, value);
+    });
+  }
+
+  /**
+   * Halves the bucket array while the load factor would stay at or below
+   * 0.75, half the level at which `insert` doubles it, so that a few
+   * inserts after shrinking don't grow it straight back.
+   *
+   * Runs in O(N+B).
+   */
+  void shrink_to_fit() {
+    size_t newCapacity = capacity;
+    while (newCapacity > 1 && 4 * sz <= 3 * (newCapacity / 2)) {
+      newCapacity /= 2;
+    }
+    if (newCapacity != capacity) {
+      rehash(newCapacity);
+    }
+  }
+
+  /**
+   * Unlinks the mapping for `key` and returns ownership of its node. Returns
+   * an empty handle if the key is not present. Frees nothing and copies
+   * nothing.
+   *
+   * Runs in O(L), where L is the length of the longest chain.
+   */
+  node_type extract(const KeyT& key) {
+    if (capacity == 0) {
+      return node_type();
+    }
+
+    size_t idx = bucketIndex(key);
+    ChainNode** link = &data[idx];
+    while (*link != nullptr && !((*link)->key == key)) {
+      link = &(*link)->next;
+    }
+
+    ChainNode* node = *link;
+    if (node == nullptr) {
+      return node_type();
+    }
+
+    *link = node->next;
+    node->next = nullptr;
+    filterRefresh(idx);
+    sz--;
+    const shared_ptr<Slab>* slab = slabs.empty() ? nullptr : slabOf(node);
+    return node_type(node, slab != nullptr ? *slab : nullptr);
+  }
+
+  /**
+   * Relinks the node held by `nh` into `this`. Returns `true` and leaves `nh`
+   * empty on success. If `nh` is empty or its key is already present, returns
+   * `false` and `nh` keeps the node (like `insert`, the existing mapping is
+   * not updated).
+   *
+   * Creates no new nodes; resizes by doubling when the load factor exceeds
+   * 1.5.
+   *
+   * Runs in O(L), where L is the length of the longest chain.
+   */
+  bool insert(node_type&& nh) {
+    if (nh.empty()) {
+      return false;
+    }
+
+    if (capacity == 0) {
+      rehash(1);
+    } else if (2 * (sz + 1) > 3 * capacity) {  // int-only check for > 1.5
+      rehash(capacity * 2);
+    }
+
+    size_t h = hashOf(nh.node->key);
+    size_t idx = h % capacity;
+    if (findNode(nh.node->key, idx) != nullptr) {
+      return false;
+    }
+
+    if (nh.slab != nullptr) {
+      shareSlab(nh.slab);
+      nh.slab.reset();
+    }
+    nh.node->next = data[idx];
+    data[idx] = nh.node;
+    filterAdd(idx, h);
+    nh.node = nullptr;
+    sz++;
+    return true;
+  }
+
+  /**
+   * Relinks every node of `other` whose key is not in `this` into `this`.
+   * Mappings whose key is already present stay in `other` (like
+   * `std::unordered_map::merge`). No node is allocated, freed or copied.
+   *
+   * Runs in O(N2 * L + B2), where N2 and B2 are the number of mappings and
+   * buckets in `other`.
+   */
+  void splice(HashMap& other) {
+    if (this == &other) {
+      return;
+    }
+
+    for (size_t i = 0; i < other.capacity; i++) {
+      ChainNode* node = other.data[i];
+      ChainNode** kept = &other.data[i];
+      while (node != nullptr) {
+        ChainNode* nextNode = node->next;
+
+        if (2 * (sz + 1) > 3 * capacity) {  // int-only check for > 1.5
+          rehash(capacity * 2);
+        }
+        size_t h = hashOf(node->key);
+        size_t idx = h % capacity;
+        if (findNode(node->key, idx) != nullptr) {
+          *kept = node;
+          kept = &node->next;
+        } else {
+          if (!other.slabs.empty()) {
+            const shared_ptr<Slab>* slab = other.slabOf(node);
+            if (slab != nullptr) {
+              shareSlab(*slab);
+            }
+          }
+          node->next = data[idx];
+          data[idx] = node;
+          filterAdd(idx, h);
+          sz++;
+          other.sz--;
+        }
+
+        node = nextNode;
+      }
+      *kept = nullptr;
+      other.filterRefresh(i);
+    }
+    other.curr = nullptr;
+    other.curr_idx = 0;
+  }
+
   /**
    * Copy constructor.
    *
-   * Copies the mappings from the provided `HashMap`.
+   * Copies the mappings from the provided `HashMap`. All nodes are carved
+   * from one contiguous block (a single allocation), and nodes with
+   * trivially copyable keys and values are copied with `memcpy`. Storage of
+   * an erased node is not reused, but the block is freed once every node
+   * carved from it is gone, wherever those nodes were moved.
    *
    * Runs in O(N+B), where N is the number of mappings in `other`, and B is the
    * number of buckets.
@@ -307,6 +2279,10 @@ class HashMap {
     sz = 0;
     curr = nullptr;
     curr_idx = 0;
+    rehash_threads = other.rehash_threads;
+    filter = nullptr;
+    memory_policy = other.memory_policy;
+    dataMapped = 0;
 
     if (other.capacity == 0) {
       data = nullptr;
@@ -315,23 +2291,17 @@ class HashMap {
     }
 
     initBuckets(other.capacity);
-
-    for (size_t i = 0; i < other.capacity; i++) {
-      ChainNode* otherNode = other.data[i];
-      ChainNode** tailPtr = &data[i];
-      while (otherNode != nullptr) {
-        *tailPtr = new ChainNode(otherNode->key, otherNode->value);
-        tailPtr = &((*tailPtr)->next);
-        otherNode = otherNode->next;
-        sz++;
-      }
-    }
+    copyNodes(other, nullptr, 0);
   }
 
   /**
    * Assignment operator; `operator=`.
    *
    * Clears this table, and copies the mappings from the provided `HashMap`.
+   * Existing nodes are rebuilt in place to hold the copies, and the bucket
+   * array (and filter) are reused if the capacities match, so assigning
+   * between maps of similar size allocates nothing. Nodes beyond those come
+   * from one contiguous block, as in the copy constructor.
    *
    * Runs in O((N1+B1) + (N2+B2)), where N1 and B1 are the number of mappings
    * and buckets in `this`, and N2 and B2 are the number of mappings and buckets
@@ -343,33 +2313,47 @@ class HashMap {
       return *this;
     }
 
-    // Clean up existing data
-    freeNodes();
-    delete[] data;
-    data = nullptr;
-    capacity = 0;
+    // Unlink every node onto a spare list to be rebuilt in place
+    ChainNode* spare = nullptr;
+    size_t spareCount = sz;
+    for (size_t i = 0; i < capacity; i++) {
+      ChainNode* node = data[i];
+      while (node != nullptr) {
+        ChainNode* nextNode = node->next;
+        node->next = spare;
+        spare = node;
+        node = nextNode;
+      }
+      data[i] = nullptr;
+    }
 
     sz = 0;
     curr = nullptr;
     curr_idx = 0;
+    rehash_threads = other.rehash_threads;
+    memory_policy = other.memory_policy;
 
-    if (other.capacity == 0) {
-      return *this;
+    if (other.filter == nullptr || capacity != other.capacity) {
+      delete[] filter;
+      filter = nullptr;
     }
-
-    initBuckets(other.capacity);
-
-    for (size_t i = 0; i < other.capacity; i++) {
-      ChainNode* otherNode = other.data[i];
-      ChainNode** tailPtr = &data[i];
-      while (otherNode != nullptr) {
-        *tailPtr = new ChainNode(otherNode->key, otherNode->value);
-        tailPtr = &((*tailPtr)->next);
-        otherNode = otherNode->next;
-        sz++;
+    if (capacity != other.capacity) {
+      freeBuckets(data, dataMapped);
+      data = nullptr;
+      dataMapped = 0;
+      capacity = 0;
+      try {
+        if (other.capacity != 0) {
+          initBuckets(other.capacity);
+        }
+      } catch (...) {
+        destroyChain(spare);
+        throw;
       }
     }
 
+    copyNodes(other, spare, spareCount);
+
     return *this;
   }
 
@@ -421,6 +2405,70 @@ class HashMap {
     return true;
   }
 
+  /**
+   * Calls `fn(key, value)` for every mapping, using `threads` threads. `fn`
+   * receives references to the stored key and value, so it may update the
+   * value in place, and it must be safe to call concurrently. Must not
+   * insert or erase.
+   *
+   * Does not visit the mappings in any defined order. Does not modify the
+   * `begin`/`next` state.
+   *
+   * Runs in O((N + B) / T) on T threads.
+   */
+  template <typename Fn>
+  void parallel_for_each(Fn fn, size_t threads) {
+    if (threads == 0) {
+      threads = 1;
+    }
+    forEachChunk(threads, [&](size_t lo, size_t hi, size_t) {
+      for (size_t i = lo; i < hi; i++) {
+        for (ChainNode* node = data[i]; node != nullptr; node = node->next) {
+          fn(node->key, node->value);
+        }
+      }
+    });
+  }
+
+  /**
+   * Maps every mapping with `map_fn(key, value)` and folds the results with
+   * `combine_fn(acc, mapped)`, starting from `init`, using `threads` threads.
+   *
+   * `combine_fn` must be associative. Partial results are combined in bucket
+   * order, so the result is deterministic for a given table even if
+   * `combine_fn` is not commutative.
+   *
+   * Runs in O((N + B) / T + T) on T threads.
+   */
+  template <typename T, typename MapFn, typename CombineFn>
+  T parallel_reduce(T init, MapFn map_fn, CombineFn combine_fn,
+                    size_t threads) const {
+    if (threads == 0) {
+      threads = 1;
+    }
+    vector<optional<T>> partials(chunkCount(threads));
+    forEachChunk(threads, [&](size_t lo, size_t hi, size_t c) {
+      optional<T>& acc = partials[c];
+      for (size_t i = lo; i < hi; i++) {
+        for (ChainNode* node = data[i]; node != nullptr; node = node->next) {
+          const ChainNode& entry = *node;
+          if (acc) {
+            acc = combine_fn(std::move(*acc), map_fn(entry.key, entry.value));
+          } else {
+            acc = map_fn(entry.key, entry.value);
+          }
+        }
+      }
+    });
+
+    for (optional<T>& partial : partials) {
+      if (partial) {
+        init = combine_fn(std::move(init), std::move(*partial));
+      }
+    }
+    return init;
+  }
+
   /**
    * Resets internal state for an iterative traversal.
    *
@@ -520,4 +2568,205 @@ class HashMap {
   size_t get_capacity() {
     return this->capacity;
   }
+
+  /**
+   * Returns the number of node slabs the `HashMap` holds. For autograder
+   * testing purposes only.
+   */
+  size_t get_slab_count() const {
+    return slabs.size();
+  }
+};
+
+/**
+ * A hash set of keys, built on `HashMap` with an empty value type, so each
+ * node holds only the key and the chain link.
+ *
+ * Unlike `HashMap`, `insert` reports whether the key was added and `erase`
+ * returns nothing.
+ *
+ * `unite`, `intersect` and `difference` each make one pass over the bucket
+ * arrays. When both sets have the same capacity a key can only be in the
+ * same bucket of the other set, so buckets are compared pairwise and no key
+ * is hashed; otherwise each key is looked up.
+ */
+template <typename KeyT>
+class HashSet {
+ private:
+  struct Present {
+    bool operator==(const Present&) const {
+      return true;
+    }
+  };
+
+  using Map = HashMap<KeyT, Present>;
+  using ChainNode = typename Map::ChainNode;
+
+  Map map;
+
+  // Calls `fn(key, idx, inOther)` for every key of `this`, where `idx` is
+  // its bucket.
+  template <typename Fn>
+  void probe(const HashSet& other, Fn fn) const {
+    bool paired = map.capacity == other.map.capacity;
+    for (size_t i = 0; i < map.capacity; i++) {
+      for (ChainNode* n = map.data[i]; n != nullptr; n = n->next) {
+        bool inOther = paired ? other.map.findNode(n->key, i) != nullptr
+                              : other.map.contains(n->key);
+        fn(n->key, i, inOther);
+      }
+    }
+  }
+
+  // Returns a set with this set's capacity holding the keys for which
+  // `keep(inOther)` is true. Keys are linked into the same bucket index, so
+  // none is hashed again.
+  template <typename Keep>
+  HashSet filtered(const HashSet& other, Keep keep) const {
+    HashSet result(map.capacity);
+    Map& out = result.map;
+    probe(other, [&](const KeyT& key, size_t idx, bool inOther) {
+      if (keep(inOther)) {
+        out.data[idx] = new ChainNode(key, Present(), out.data[idx]);
+        out.sz++;
+      }
+    });
+    return result;
+  }
+
+ public:
+  /**
+   * Creates an empty `HashSet` with 10 buckets.
+   */
+  HashSet() : map() {
+  }
+
+  /**
+   * Creates an empty `HashSet` with `capacity` buckets.
+   */
+  explicit HashSet(size_t capacity) : map(capacity) {
+  }
+
+  bool empty() const {
+    return map.empty();
+  }
+
+  size_t size() const {
+    return map.size();
+  }
+
+  size_t get_capacity() const {
+    return map.capacity;
+  }
+
+  /**
+   * Adds `key`. Returns `true` if it was not already present.
+   *
+   * Runs in amortized O(L), where L is the length of the longest chain.
+   */
+  bool insert(const KeyT& key) {
+    size_t before = map.size();
+    map.insert(key, Present());
+    return map.size() != before;
+  }
+
+  /**
+   * Returns `true` if the key is present.
+   *
+   * Runs in O(L), where L is the length of the longest chain.
+   */
+  bool contains(const KeyT& key) const {
+    return map.contains(key);
+  }
+
+  /**
+   * Removes `key`. Throws `out_of_range` if it is not present.
+   *
+   * Runs in O(L), where L is the length of the longest chain.
+   */
+  void erase(const KeyT& key) {
+    map.erase(key);
+  }
+
+  /**
+   * Removes every key for which `pred(key)` returns `true`, and returns the
+   * number removed. See `HashMap::erase_if`.
+   *
+   * Runs in O(N+B).
+   */
+  template <typename Pred>
+  size_t erase_if(Pred pred) {
+    return map.erase_if(
+        [&pred](const KeyT& key, const Present&) { return pred(key); });
+  }
+
+  /**
+   * Removes all keys, keeping the bucket count.
+   *
+   * Runs in O(N+B).
+   */
+  void clear() {
+    map.clear();
+  }
+
+  /**
+   * Returns a set of the keys in `this`, `other` or both: a copy of `this`
+   * (see the `HashMap` copy constructor) plus the keys only in `other`.
+   *
+   * Runs in O(N1 + N2 * L + B1 + B2).
+   */
+  HashSet unite(const HashSet& other) const {
+    HashSet result(*this);
+    other.probe(*this, [&](const KeyT& key, size_t, bool inThis) {
+      if (!inThis) {
+        result.map.insert(key, Present());
+      }
+    });
+    return result;
+  }
+
+  /**
+   * Returns a set of the keys in both `this` and `other`, with the capacity
+   * of `this`.
+   *
+   * Runs in O(N1 * L + B1).
+   */
+  HashSet intersect(const HashSet& other) const {
+    return filtered(other, [](bool inOther) { return inOther; });
+  }
+
+  /**
+   * Returns a set of the keys in `this` but not in `other`, with the
+   * capacity of `this`.
+   *
+   * Runs in O(N1 * L + B1).
+   */
+  HashSet difference(const HashSet& other) const {
+    return filtered(other, [](bool inOther) { return !inOther; });
+  }
+
+  /**
+   * Returns `true` if both sets hold the same keys.
+   *
+   * Runs in O(N * L + B).
+   */
+  bool operator==(const HashSet& other) const {
+    return map == other.map;
+  }
+
+  /**
+   * Resets internal state for an iterative traversal. See `HashMap::begin`.
+   */
+  void begin() {
+    map.begin();
+  }
+
+  /**
+   * Sets `key` to the next key and returns `true`, or returns `false` once
+   * every key has been visited. See `HashMap::next`.
+   */
+  bool next(KeyT& key) {
+    Present present;
+    return map.next(key, present);
+  }
 };
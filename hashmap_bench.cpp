@@ -0,0 +1,276 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "hashmap.h"
+
+using namespace std;
+
+// Throughput benchmarks for `HashMap` internals whose speedups are quoted in
+// the docs. Each case runs `reps` times and reports the fastest run, so
+// that one-off interference (page faults, frequency ramp-up) does not count.
+//
+// Usage: ./hashmap_bench [reps]
+
+namespace {
+
+// Times `fn`. If it returns a value, destroying that value is not timed.
+template <typename Fn>
+double bestMillis(int reps, Fn fn) {
+  double best = 0;
+  for (int r = 0; r < reps; r++) {
+    auto start = chrono::steady_clock::now();
+    double ms;
+    if constexpr (is_void_v<invoke_result_t<Fn>>) {
+      fn();
+      ms = chrono::duration<double, milli>(chrono::steady_clock::now() -
+                                           start)
+               .count();
+    } else {
+      auto kept = fn();
+      ms = chrono::duration<double, milli>(chrono::steady_clock::now() -
+                                           start)
+               .count();
+    }
+    if (r == 0 || ms < best) {
+      best = ms;
+    }
+  }
+  return best;
+}
+
+void report(const char* name, double ms, double baselineMs) {
+  printf("%-28s %10.2f ms %8.2fx\n", name, ms, baselineMs / ms);
+}
+
+// Reduces 1M 32-bit and 1M 64-bit hashes to bucket indices with each
+// kernel.
+void benchBucketIndices(int reps) {
+  const size_t n = size_t(1) << 20;
+  const size_t d = 1000003;
+  mt19937_64 rng(38);
+  vector<size_t> narrow(n);
+  vector<size_t> wide(n);
+  for (size_t i = 0; i < n; i++) {
+    wide[i] = rng();
+    narrow[i] = wide[i] & UINT32_MAX;
+  }
+  vector<size_t> out(n);
+
+  using Kernel = void (*)(const size_t*, size_t, size_t, size_t*);
+  vector<pair<const char*, Kernel>> kernels = {
+      {"bucket_indices scalar", bucketIndicesScalar}};
+#ifdef HASHMAP_X86_KERNELS
+  if (__builtin_cpu_supports("avx2")) {
+    kernels.push_back({"bucket_indices avx2", bucketIndicesAvx2});
+  }
+  if (__builtin_cpu_supports("avx512f")) {
+    kernels.push_back({"bucket_indices avx512", bucketIndicesAvx512});
+  }
+#endif
+
+  for (const vector<size_t>* hashes : {&narrow, &wide}) {
+    printf("%s%zu %d-bit hashes, %zu buckets\n", hashes == &wide ? "\n" : "",
+           n, hashes == &wide ? 64 : 32, d);
+    double baseline = 0;
+    for (const auto& [name, kernel] : kernels) {
+      double ms = bestMillis(reps, [&]() {
+        kernel(hashes->data(), n, d, out.data());
+        // Keep the result observable so the call is not optimized away
+        asm volatile("" : : "r"(out.data()) : "memory");
+      });
+      if (baseline == 0) {
+        baseline = ms;
+      }
+      report(name, ms, baseline);
+    }
+  }
+}
+
+// The copy path `HashMap` had before slabs: one `new` per node in chain
+// order, one `delete` per node on destruction, and assignment as destroy
+// then copy.
+class NodeByNodeMap {
+ private:
+  using Node = HashMapNode<int, int>;
+
+  Node** data;
+  size_t capacity;
+
+  void copyChains(Node* const* buckets, size_t cap) {
+    capacity = cap;
+    data = new Node*[capacity]();
+    for (size_t i = 0; i < capacity; i++) {
+      Node** tailPtr = &data[i];
+      for (Node* node = buckets[i]; node != nullptr; node = node->next) {
+        *tailPtr = new Node(node->key, node->value);
+        tailPtr = &(*tailPtr)->next;
+      }
+    }
+  }
+
+  void freeChains() {
+    for (size_t i = 0; i < capacity; i++) {
+      Node* node = data[i];
+      while (node != nullptr) {
+        Node* next = node->next;
+        delete node;
+        node = next;
+      }
+    }
+    delete[] data;
+  }
+
+ public:
+  explicit NodeByNodeMap(HashMap<int, int>& map) {
+    copyChains(static_cast<Node* const*>(map.get_data()), map.get_capacity());
+  }
+
+  NodeByNodeMap(const NodeByNodeMap& other) {
+    copyChains(other.data, other.capacity);
+  }
+
+  NodeByNodeMap& operator=(const NodeByNodeMap& other) {
+    if (this != &other) {
+      freeChains();
+      copyChains(other.data, other.capacity);
+    }
+    return *this;
+  }
+
+  ~NodeByNodeMap() {
+    freeChains();
+  }
+};
+
+// Copies and assigns a 1M-mapping map with slab-backed nodes, against the
+// node-by-node copy it replaced.
+void benchClone(int reps) {
+  const int n = 1 << 20;
+  HashMap<int, int> source;
+  for (int i = 0; i < n; i++) {
+    source.insert(i, i);
+  }
+  NodeByNodeMap oldSource(source);
+
+  printf("\n%d mappings\n", n);
+  double base = bestMillis(reps, [&]() { NodeByNodeMap copy(oldSource); });
+  report("copy+destroy, node by node", base, base);
+  double ms = bestMillis(reps, [&]() { HashMap<int, int> copy(source); });
+  report("copy+destroy, one slab", ms, base);
+
+  base = bestMillis(reps, [&]() { return NodeByNodeMap(oldSource); });
+  report("copy, node by node", base, base);
+  ms = bestMillis(reps, [&]() { return HashMap<int, int>(source); });
+  report("copy, one slab", ms, base);
+
+  // Assigning over a map of the same size, as when refreshing a snapshot
+  NodeByNodeMap oldTarget(oldSource);
+  base = bestMillis(reps, [&]() {
+    oldTarget = oldSource;
+    asm volatile("" : : "r"(&oldTarget) : "memory");
+  });
+  report("assign, node by node", base, base);
+  HashMap<int, int> target(source);
+  ms = bestMillis(reps, [&]() {
+    target = source;
+    asm volatile("" : : "r"(&target) : "memory");
+  });
+  report("assign, reusing nodes", ms, base);
+}
+
+// Looks up `probes` in `map` with `contains_many`, and with batches of
+// `contains_async` lookups interleaved by a `LookupScheduler`, against a loop
+// over `contains`. Half the probes are present.
+template <typename K>
+void benchLookups(const char* name, const HashMap<K, int>& map,
+                  const vector<K>& probes, int reps) {
+  vector<uint8_t> loopFound(probes.size());
+  double base = bestMillis(reps, [&]() {
+    for (size_t i = 0; i < probes.size(); i++) {
+      loopFound[i] = map.contains(probes[i]);
+    }
+    asm volatile("" : : "r"(loopFound.data()) : "memory");
+  });
+  vector<uint8_t> found;
+  double ms = bestMillis(reps, [&]() { found = map.contains_many(probes); });
+  if (found != loopFound) {
+    printf("%s: contains_many disagrees with contains\n", name);
+  }
+
+  // Frames come from the scheduler's pool, so only the first batch
+  // allocates
+  const size_t batch = 64;
+  LookupScheduler scheduler(16);
+  vector<LookupTask<bool>> tasks;
+  tasks.reserve(batch);
+  vector<uint8_t> asyncFound(probes.size());
+  double asyncMs = bestMillis(reps, [&]() {
+    for (size_t base = 0; base < probes.size(); base += batch) {
+      size_t count = min(batch, probes.size() - base);
+      tasks.clear();
+      for (size_t i = 0; i < count; i++) {
+        tasks.push_back(map.contains_async(probes[base + i], &scheduler));
+        scheduler.submit(tasks.back());
+      }
+      scheduler.run();
+      for (size_t i = 0; i < count; i++) {
+        asyncFound[base + i] = tasks[i].get();
+      }
+    }
+  });
+  if (asyncFound != loopFound) {
+    printf("%s: contains_async disagrees with contains\n", name);
+  }
+
+  printf("\n%s, %zu mappings, %zu probes\n", name, map.size(),
+         probes.size());
+  report("contains loop", base, base);
+  report("contains_many", ms, base);
+  report("contains_async, 16 wide", asyncMs, base);
+}
+
+// Builds a map of `n` keys from `keyOf(i)` and probes it with keys
+// `keyOf(i)` for random i in [0, 2n).
+template <typename K, typename KeyOf>
+void benchContainsMany(const char* name, size_t n, KeyOf keyOf, int reps) {
+  HashMap<K, int> map;
+  for (size_t i = 0; i < n; i++) {
+    map.insert(keyOf(i), 1);
+  }
+  mt19937_64 rng(38);
+  vector<K> probes(size_t(1) << 20);
+  for (K& key : probes) {
+    key = keyOf(rng() % (2 * n));
+  }
+  benchLookups(name, map, probes, reps);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  int reps = argc > 1 ? stoi(argv[1]) : 20;
+  benchBucketIndices(reps);
+  benchClone(reps);
+  benchContainsMany<int>(
+      "int keys", size_t(8) << 20,
+      [](size_t i) { return static_cast<int>(i); }, reps);
+  // Random 64-bit keys: hashes above 2^32 take the Barrett kernels
+  benchContainsMany<uint64_t>(
+      "uint64_t keys", size_t(4) << 20,
+      [](size_t i) { return (i + 1) * 0x9E3779B97F4A7C15ull; }, reps);
+  benchContainsMany<string>(
+      "string keys", size_t(1) << 20,
+      [](size_t i) { return "key" + to_string(i); }, reps);
+  // Too long for the small-string buffer, so comparing a key is one more
+  // dependent miss
+  benchContainsMany<string>(
+      "long string keys", size_t(1) << 20,
+      [](size_t i) { return "a-long-key-prefix-" + to_string(i); }, reps);
+}
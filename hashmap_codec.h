@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+using namespace std;
+
+/**
+ * Binary encoding of keys and values for on-disk formats (the write-ahead
+ * log and checkpoints of `DurableHashMap`, the spill file of
+ * `TieredHashMap`).
+ *
+ * `encode` appends the bytes of `v` to `out`. `decode` reads one value
+ * starting at `p`, advances `p` past it, and returns `false` if fewer than
+ * the required bytes remain before `end`.
+ *
+ * Provided for trivially copyable types (copied bytewise, so files are only
+ * portable between hosts with the same layout and endianness) and for
+ * `std::string`. Specialize `Codec` for other types.
+ */
+template <typename T, typename Enable = void>
+struct Codec;
+
+template <typename T>
+struct Codec<T, enable_if_t<is_trivially_copyable_v<T>>> {
+  static void encode(const T& v, string& out) {
+    out.append(reinterpret_cast<const char*>(&v), sizeof(T));
+  }
+
+  static bool decode(const char*& p, const char* end, T& v) {
+    if (static_cast<size_t>(end - p) < sizeof(T)) {
+      return false;
+    }
+    memcpy(&v, p, sizeof(T));
+    p += sizeof(T);
+    return true;
+  }
+};
+
+template <>
+struct Codec<string> {
+  static void encode(const string& v, string& out) {
+    Codec<uint32_t>::encode(static_cast<uint32_t>(v.size()), out);
+    out.append(v);
+  }
+
+  static bool decode(const char*& p, const char* end, string& v) {
+    uint32_t len;
+    if (!Codec<uint32_t>::decode(p, end, len) ||
+        static_cast<size_t>(end - p) < len) {
+      return false;
+    }
+    v.assign(p, len);
+    p += len;
+    return true;
+  }
+};
+
+/**
+ * CRC-32 (IEEE 802.3) of `n` bytes, used to detect torn or corrupted
+ * records.
+ */
+inline uint32_t checksum32(const char* data, size_t n) {
+  static const auto table = []() {
+    struct {
+      uint32_t entries[256];
+    } t;
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; k++) {
+        c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+      }
+      t.entries[i] = c;
+    }
+    return t;
+  }();
+
+  uint32_t crc = 0xFFFFFFFFu;
+  for (size_t i = 0; i < n; i++) {
+    crc = table.entries[(crc ^ static_cast<uint8_t>(data[i])) & 0xFF] ^
+          (crc >> 8);
+  }
+  return crc ^ 0xFFFFFFFFu;
+}
+
+/**
+ * Appends `payload` to `out` framed as [u32 length][u32 CRC-32][payload].
+ */
+inline void appendFramed(string& out, const string& payload) {
+  Codec<uint32_t>::encode(static_cast<uint32_t>(payload.size()), out);
+  Codec<uint32_t>::encode(checksum32(payload.data(), payload.size()), out);
+  out.append(payload);
+}
+
+/**
+ * Reads the framed record at `p`, pointing `payload` and `len` at its body
+ * and advancing `p` past it. Returns `false`, leaving `p` unchanged, at the
+ * end of the data or at a torn or corrupt record.
+ */
+inline bool readFramed(const char*& p, const char* end, const char*& payload,
+                       size_t& len) {
+  const char* q = p;
+  uint32_t n;
+  uint32_t crc;
+  if (!Codec<uint32_t>::decode(q, end, n) ||
+      !Codec<uint32_t>::decode(q, end, crc) ||
+      static_cast<size_t>(end - q) < n || checksum32(q, n) != crc) {
+    return false;
+  }
+  payload = q;
+  len = n;
+  p = q + n;
+  return true;
+}
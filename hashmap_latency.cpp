@@ -0,0 +1,327 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HASHMAP_LATENCY_RDTSC 1
+#endif
+
+#include "hashmap.h"
+
+using namespace std;
+
+// Tail-latency harness for `HashMap`.
+//
+// Times every operation individually under several mixed workloads and
+// prints p50/p99/p99.9/max per operation type. Each insert that grows the
+// bucket array is written to a timeline CSV so that latency spikes can be
+// lined up with rehash events.
+//
+// The optional backing selects how bucket arrays are allocated (default,
+// thp, 2m or 1g; see `MemoryPolicy`). Run under
+// `perf stat -e dTLB-loads,dTLB-load-misses` to compare TLB misses, or use
+// `make perf_tlb`.
+//
+// Usage: ./hashmap_latency [ops per workload] [timeline csv] [backing]
+
+namespace {
+
+// Cycle counter where available (calibrated against steady_clock), otherwise
+// steady_clock directly.
+class Clock {
+ private:
+  double nsPerTick = 1.0;
+
+ public:
+  Clock() {
+#ifdef HASHMAP_LATENCY_RDTSC
+    auto wallStart = chrono::steady_clock::now();
+    uint64_t tickStart = __rdtsc();
+    while (chrono::steady_clock::now() - wallStart <
+           chrono::milliseconds(50)) {
+    }
+    uint64_t ticks = __rdtsc() - tickStart;
+    double ns = chrono::duration<double, nano>(chrono::steady_clock::now() -
+                                               wallStart)
+                    .count();
+    nsPerTick = ns / static_cast<double>(ticks);
+#endif
+  }
+
+  uint64_t now() const {
+#ifdef HASHMAP_LATENCY_RDTSC
+    _mm_lfence();
+    uint64_t t = __rdtsc();
+    _mm_lfence();
+    return t;
+#else
+    return chrono::duration_cast<chrono::nanoseconds>(
+               chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+  }
+
+  uint64_t toNanos(uint64_t ticks) const {
+    return static_cast<uint64_t>(static_cast<double>(ticks) * nsPerTick);
+  }
+};
+
+// HDR-style log-linear histogram: values are grouped by power of two, and
+// each power of two is split into 64 linear sub-buckets, giving roughly 1.5%
+// relative precision over the whole range.
+class LatencyHistogram {
+ private:
+  static constexpr int kSubBits = 6;
+  static constexpr uint64_t kSubCount = uint64_t(1) << kSubBits;
+
+  vector<uint64_t> counts = vector<uint64_t>(64 * kSubCount, 0);
+  uint64_t total = 0;
+  uint64_t maxValue = 0;
+
+  static size_t indexOf(uint64_t v) {
+    if (v < kSubCount) {
+      return static_cast<size_t>(v);
+    }
+    int exp = 63 - __builtin_clzll(v);
+    int shift = exp - kSubBits;
+    uint64_t sub = (v >> shift) - kSubCount;
+    return static_cast<size_t>((shift + 1) * kSubCount + sub);
+  }
+
+  // Upper bound of the values that map to bucket `idx`.
+  static uint64_t valueOf(size_t idx) {
+    if (idx < kSubCount) {
+      return idx;
+    }
+    int shift = static_cast<int>(idx / kSubCount) - 1;
+    uint64_t sub = idx % kSubCount;
+    return ((kSubCount + sub + 1) << shift) - 1;
+  }
+
+ public:
+  void record(uint64_t v) {
+    counts[indexOf(v)]++;
+    total++;
+    maxValue = max(maxValue, v);
+  }
+
+  uint64_t count() const {
+    return total;
+  }
+
+  uint64_t max_value() const {
+    return maxValue;
+  }
+
+  uint64_t percentile(double p) const {
+    if (total == 0) {
+      return 0;
+    }
+    uint64_t rank =
+        max<uint64_t>(1, static_cast<uint64_t>(ceil(p / 100.0 * total)));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts.size(); i++) {
+      seen += counts[i];
+      if (seen >= rank) {
+        return min(valueOf(i), maxValue);
+      }
+    }
+    return maxValue;
+  }
+};
+
+enum Op { kInsert, kAt, kContains, kErase, kBegin, kOpCount };
+
+const char* kOpNames[kOpCount] = {"insert", "at", "contains", "erase",
+                                  "begin"};
+
+// Percentage of operations of each type, in `Op` order.
+struct Mix {
+  int percent[kOpCount];
+};
+
+enum class KeyDist { kUniform, kZipfian, kColliding };
+
+struct Workload {
+  string name;
+  Mix mix;
+  KeyDist dist;
+  uint64_t keySpace;
+};
+
+// Zipfian sampler over [0, n) with exponent `s`, using an inverted CDF.
+class Zipfian {
+ private:
+  vector<double> cdf;
+
+ public:
+  Zipfian(uint64_t n, double s) : cdf(n) {
+    double sum = 0;
+    for (uint64_t i = 0; i < n; i++) {
+      sum += 1.0 / pow(static_cast<double>(i + 1), s);
+      cdf[i] = sum;
+    }
+    for (double& c : cdf) {
+      c /= sum;
+    }
+  }
+
+  uint64_t operator()(mt19937_64& rng) const {
+    double u = uniform_real_distribution<double>(0.0, 1.0)(rng);
+    return static_cast<uint64_t>(lower_bound(cdf.begin(), cdf.end(), u) -
+                                 cdf.begin());
+  }
+};
+
+struct RehashEvent {
+  string workload;
+  uint64_t opIndex;
+  uint64_t elapsedNs;
+  size_t oldCapacity;
+  size_t newCapacity;
+  uint64_t latencyNs;
+};
+
+MemoryPolicy parseBacking(const string& name) {
+  MemoryPolicy policy;
+  if (name == "thp") {
+    policy.pages = PageBacking::kTransparentHuge;
+  } else if (name == "2m") {
+    policy.pages = PageBacking::kHuge2M;
+  } else if (name == "1g") {
+    policy.pages = PageBacking::kHuge1G;
+  } else if (name != "default") {
+    throw invalid_argument("unknown backing: " + name);
+  }
+  return policy;
+}
+
+void runWorkload(const Workload& w, uint64_t ops, const MemoryPolicy& policy,
+                 const Clock& clock, vector<RehashEvent>& timeline) {
+  HashMap<uint64_t, uint64_t> hm;
+  hm.set_memory_policy(policy);
+  LatencyHistogram hist[kOpCount];
+  mt19937_64 rng(251);
+  Zipfian zipf(w.dist == KeyDist::kZipfian ? w.keySpace : 1, 0.99);
+
+  // std::hash on integers is the identity, so multiples of 10 * 2^20 land in
+  // bucket 0 for every capacity this map reaches (10 * 2^k, k <= 20).
+  auto pickKey = [&]() -> uint64_t {
+    uint64_t k = w.dist == KeyDist::kZipfian ? zipf(rng) : rng() % w.keySpace;
+    return w.dist == KeyDist::kColliding ? k * (uint64_t(10) << 20) : k;
+  };
+
+  // Pre-populate half the key space so reads and erases have targets.
+  for (uint64_t i = 0; i < w.keySpace / 2; i++) {
+    uint64_t k = pickKey();
+    hm.insert(k, k);
+  }
+
+  uint64_t start = clock.now();
+  volatile uint64_t sink = 0;
+  for (uint64_t i = 0; i < ops; i++) {
+    int roll = static_cast<int>(rng() % 100);
+    int op = 0;
+    while (roll >= w.mix.percent[op]) {
+      roll -= w.mix.percent[op];
+      op++;
+    }
+
+    uint64_t key = pickKey();
+    size_t capBefore = hm.get_capacity();
+    uint64_t t0 = clock.now();
+    switch (op) {
+      case kInsert:
+        hm.insert(key, key);
+        break;
+      case kAt:
+        try {
+          sink = sink + hm.at(key);
+        } catch (const out_of_range&) {
+        }
+        break;
+      case kContains:
+        sink = sink + hm.contains(key);
+        break;
+      case kErase:
+        try {
+          sink = sink + hm.erase(key);
+        } catch (const out_of_range&) {
+        }
+        break;
+      case kBegin:
+        hm.begin();
+        break;
+    }
+    uint64_t t1 = clock.now();
+    uint64_t ns = clock.toNanos(t1 - t0);
+    hist[op].record(ns);
+
+    if (hm.get_capacity() != capBefore) {
+      timeline.push_back({w.name, i, clock.toNanos(t0 - start), capBefore,
+                          hm.get_capacity(), ns});
+    }
+  }
+
+  printf("\n== %s (%llu ops, final size %zu, capacity %zu)\n", w.name.c_str(),
+         static_cast<unsigned long long>(ops), hm.size(), hm.get_capacity());
+  printf("%-10s %10s %10s %10s %10s %12s\n", "op", "count", "p50 ns",
+         "p99 ns", "p99.9 ns", "max ns");
+  for (int op = 0; op < kOpCount; op++) {
+    if (hist[op].count() == 0) {
+      continue;
+    }
+    printf("%-10s %10llu %10llu %10llu %10llu %12llu\n", kOpNames[op],
+           static_cast<unsigned long long>(hist[op].count()),
+           static_cast<unsigned long long>(hist[op].percentile(50)),
+           static_cast<unsigned long long>(hist[op].percentile(99)),
+           static_cast<unsigned long long>(hist[op].percentile(99.9)),
+           static_cast<unsigned long long>(hist[op].max_value()));
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  uint64_t ops = argc > 1 ? stoull(argv[1]) : 1000000;
+  string timelinePath = argc > 2 ? argv[2] : "latency_timeline.csv";
+  MemoryPolicy policy = parseBacking(argc > 3 ? argv[3] : "default");
+
+  Clock clock;
+
+  // Percentages in `Op` order: insert, at, contains, erase, begin.
+  vector<Workload> workloads = {
+      {"read-heavy", {{4, 60, 31, 5, 0}}, KeyDist::kUniform, 1 << 20},
+      {"write-heavy", {{50, 15, 5, 30, 0}}, KeyDist::kUniform, 1 << 20},
+      {"churn", {{45, 5, 4, 45, 1}}, KeyDist::kUniform, 1 << 16},
+      {"zipfian", {{5, 70, 20, 5, 0}}, KeyDist::kZipfian, 1 << 20},
+      {"collisions", {{30, 40, 20, 10, 0}}, KeyDist::kColliding, 1 << 10},
+  };
+
+  vector<RehashEvent> timeline;
+  for (const Workload& w : workloads) {
+    // Colliding chains make every operation O(N); keep that run short.
+    uint64_t n =
+        w.dist == KeyDist::kColliding ? min<uint64_t>(ops, 20000) : ops;
+    runWorkload(w, n, policy, clock, timeline);
+  }
+
+  ofstream out(timelinePath);
+  out << "workload,op_index,elapsed_ns,event,old_capacity,new_capacity,"
+         "latency_ns\n";
+  for (const RehashEvent& e : timeline) {
+    out << e.workload << "," << e.opIndex << "," << e.elapsedNs << ",rehash,"
+        << e.oldCapacity << "," << e.newCapacity << "," << e.latencyNs
+        << "\n";
+  }
+  printf("\n%zu rehash events written to %s\n", timeline.size(),
+         timelinePath.c_str());
+}
@@ -1,9 +1,28 @@
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <climits>
+#include <csignal>
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+#include <optional>
 #include <random>
+#include <set>
+#include <thread>
 
+#include "columnar_hashmap.h"
+#include "compact_hashmap.h"
+#include "concurrent_hashmap.h"
+#include "durable_hashmap.h"
 #include "hashmap.h"
+#include "snapshot_hashmap.h"
+#include "string_hashmap.h"
+#include "tiered_hashmap.h"
 
 using namespace std;
 using namespace testing;
@@ -15,6 +34,26 @@ struct CollidingInt {
   }
 };
 
+// Key that counts equality comparisons, i.e. chain nodes examined.
+struct CountedKey {
+  static inline size_t compares = 0;
+  int value;
+  bool operator==(const CountedKey& other) const {
+    compares++;
+    return value == other.value;
+  }
+};
+
+// Key that records every thread its hash runs on.
+struct ThreadTrackedKey {
+  static inline mutex mu;
+  static inline set<thread::id> threads;
+  int value;
+  bool operator==(const ThreadTrackedKey& other) const {
+    return value == other.value;
+  }
+};
+
 namespace std {
 template <>
 struct hash<CollidingInt> {
@@ -22,6 +61,22 @@ struct hash<CollidingInt> {
     return 0;
   }
 };
+
+template <>
+struct hash<CountedKey> {
+  size_t operator()(const CountedKey& k) const noexcept {
+    return hash<int>()(k.value);
+  }
+};
+
+template <>
+struct hash<ThreadTrackedKey> {
+  size_t operator()(const ThreadTrackedKey& k) const noexcept {
+    lock_guard<mutex> lock(ThreadTrackedKey::mu);
+    ThreadTrackedKey::threads.insert(this_thread::get_id());
+    return hash<int>()(k.value);
+  }
+};
 }  // namespace std
 
 namespace {
@@ -569,4 +624,2061 @@ TEST(HashMapCore, EraseMiddleWithSuccessorKeepsChainIntact) {
   EXPECT_EQ(hm.size(), 5);
 }
 
+TEST(HashMapConcurrent, SingleThreadedOperations) {
+  ConcurrentHashMap<int, string> hm;
+  EXPECT_TRUE(hm.empty());
+  EXPECT_EQ(hm.get_capacity(), static_cast<size_t>(10));
+
+  hm.insert(1, "one");
+  hm.insert(2, "two");
+  hm.insert(1, "uno");  // should NOT overwrite
+
+  EXPECT_EQ(hm.size(), static_cast<size_t>(2));
+  EXPECT_TRUE(hm.contains(1));
+  EXPECT_EQ(hm.at(1), "one");
+  EXPECT_FALSE(hm.contains(3));
+  EXPECT_THROW(hm.at(3), out_of_range);
+
+  EXPECT_EQ(hm.erase(1), "one");
+  EXPECT_FALSE(hm.contains(1));
+  EXPECT_THROW(hm.erase(1), out_of_range);
+  EXPECT_EQ(hm.size(), static_cast<size_t>(1));
+
+  hm.clear();
+  EXPECT_TRUE(hm.empty());
+  EXPECT_FALSE(hm.contains(2));
+}
+
+TEST(HashMapConcurrent, ResizeKeepsAllMappings) {
+  ConcurrentHashMap<int, int> hm;
+  for (int i = 0; i < 100; ++i) {
+    hm.insert(i, i * 3);
+  }
+  EXPECT_GT(hm.get_capacity(), static_cast<size_t>(10));
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_EQ(hm.at(i), i * 3);
+  }
+}
+
+TEST(HashMapConcurrent, RetiredTablesAreFreedPromptly) {
+  ConcurrentHashMap<int, int> hm;
+  for (int i = 0; i < 100000; ++i) {
+    hm.insert(i, i);
+  }
+  // With no reader in the way, each resize frees the table it replaced
+  EXPECT_EQ(hm.get_retired_count(), 0u);
+
+  // A reader in a read section holds back a table retired after it entered
+  ConcurrentHashMap<int, int> other;
+  optional<EpochDomain::ReadGuard> guard(in_place);
+  other.insert(1, 1);
+  other.clear();
+  EXPECT_EQ(other.get_retired_count(), 1u);
+  guard.reset();
+  other.insert(2, 2);
+  EXPECT_EQ(other.get_retired_count(), 0u);
+  EXPECT_EQ(hm.at(99999), 99999);
+}
+
+TEST(HashMapConcurrent, ReadersSeeConsistentValuesDuringWrites) {
+  ConcurrentHashMap<int, int> hm;
+  const int kKeys = 512;
+  atomic<bool> done{false};
+  atomic<int> badReads{0};
+
+  vector<thread> readers;
+  for (int t = 0; t < 4; ++t) {
+    readers.emplace_back([&]() {
+      while (!done.load()) {
+        for (int k = 0; k < kKeys; ++k) {
+          try {
+            if (hm.at(k) != k * 2) {
+              badReads++;
+            }
+          } catch (const out_of_range&) {
+            // Key not currently present.
+          }
+          hm.contains(k);
+        }
+      }
+    });
+  }
+
+  // Churn exercises rehash, erase and clear while readers traverse.
+  for (int round = 0; round < 20; ++round) {
+    for (int k = 0; k < kKeys; ++k) {
+      hm.insert(k, k * 2);
+    }
+    for (int k = 0; k < kKeys; k += 2) {
+      EXPECT_EQ(hm.erase(k), k * 2);
+    }
+    if (round % 5 == 4) {
+      hm.clear();
+    }
+  }
+  done = true;
+  for (thread& t : readers) {
+    t.join();
+  }
+
+  EXPECT_EQ(badReads.load(), 0);
+}
+
+TEST(HashMapParallel, BuildParallelMatchesSequentialInsert) {
+  vector<pair<int, int>> pairs;
+  Random::seed(7);
+  for (int i = 0; i < 5000; ++i) {
+    int k = Random::randInt(3000);
+    pairs.push_back({k, i});  // duplicates keep the first value
+  }
+
+  HashMap<int, int> expected;
+  for (const auto& p : pairs) {
+    expected.insert(p.first, p.second);
+  }
+
+  HashMap<int, int> hm;
+  hm.insert(-1, -1);
+  hm.build_parallel(pairs, 4);
+
+  EXPECT_EQ(hm.size(), expected.size() + 1);
+  EXPECT_EQ(hm.at(-1), -1);
+  for (const auto& p : pairs) {
+    EXPECT_EQ(hm.at(p.first), expected.at(p.first));
+  }
+  // Load factor stays within the insert threshold
+  EXPECT_LE(2 * hm.size(), 3 * hm.get_capacity());
+}
+
+TEST(HashMapParallel, BuildParallelEmptyRangeAndSingleThread) {
+  HashMap<string, int> hm;
+  vector<pair<string, int>> none;
+  hm.build_parallel(none, 4);
+  EXPECT_TRUE(hm.empty());
+  EXPECT_EQ(hm.get_capacity(), static_cast<size_t>(10));
+
+  vector<pair<string, int>> some = {{"a", 1}, {"b", 2}, {"a", 3}};
+  hm.build_parallel(some, 1);
+  EXPECT_EQ(hm.size(), static_cast<size_t>(2));
+  EXPECT_EQ(hm.at("a"), 1);
+  EXPECT_EQ(hm.at("b"), 2);
+}
+
+// Value whose copy constructor throws once `copiesLeft` runs out, to fail a
+// bulk operation partway through.
+struct FragileValue {
+  static atomic<long> copiesLeft;
+  int v = 0;
+
+  FragileValue() = default;
+
+  FragileValue(int v) : v(v) {
+  }
+
+  FragileValue(const FragileValue& other) : v(other.v) {
+    if (copiesLeft.fetch_sub(1) <= 0) {
+      throw runtime_error("copy failed");
+    }
+  }
+
+  FragileValue& operator=(const FragileValue&) = default;
+
+  bool operator==(const FragileValue& other) const {
+    return v == other.v;
+  }
+};
+
+atomic<long> FragileValue::copiesLeft{LONG_MAX};
+
+// Counts the mappings reachable through begin/next.
+size_t countByIteration(HashMap<int, FragileValue>& map) {
+  FragileValue::copiesLeft = LONG_MAX;
+  size_t visited = 0;
+  int key;
+  FragileValue value;
+  map.begin();
+  while (map.next(key, value)) {
+    visited++;
+  }
+  return visited;
+}
+
+TEST(HashMapParallel, BuildParallelFailureKeepsSizeConsistent) {
+  vector<pair<int, FragileValue>> pairs;
+  for (int i = 0; i < 4000; ++i) {
+    pairs.push_back({i, FragileValue(i)});
+  }
+
+  HashMap<int, FragileValue> hm;
+  hm.insert(-1, FragileValue(-1));
+  FragileValue::copiesLeft = 3000;
+  EXPECT_THROW(hm.build_parallel(pairs, 4), runtime_error);
+
+  size_t linked = countByIteration(hm);
+  EXPECT_GT(linked, static_cast<size_t>(1));
+  EXPECT_LT(linked, pairs.size() + 1);
+  EXPECT_EQ(hm.size(), linked);
+
+  // The map is still usable, and a retry adds only the missing keys
+  hm.build_parallel(pairs, 4);
+  EXPECT_EQ(hm.size(), pairs.size() + 1);
+  EXPECT_EQ(countByIteration(hm), hm.size());
+  EXPECT_EQ(hm.at(3999).v, 3999);
+}
+
+TEST(HashMapParallel, ParallelRehashKeepsMappingsAndChainOrder) {
+  const size_t kCap = size_t(1) << 16;
+  HashMap<int, int> serial(kCap);
+  HashMap<int, int> parallel(kCap);
+  parallel.set_rehash_threads(4);
+  parallel.set_filter(true);  // rebuilt by the parallel rehash too
+
+  // 3 * kCap / 2 + 1 entries forces a single doubling
+  const int kCount = static_cast<int>(3 * kCap / 2 + 1);
+  for (int i = 0; i < kCount; ++i) {
+    serial.insert(i * 7, i);
+    parallel.insert(i * 7, i);
+  }
+
+  ASSERT_EQ(parallel.get_capacity(), kCap * 2);
+  EXPECT_EQ(parallel.size(), serial.size());
+
+  serial.begin();
+  parallel.begin();
+  int k1, v1, k2, v2;
+  while (serial.next(k1, v1)) {
+    ASSERT_TRUE(parallel.next(k2, v2));
+    ASSERT_EQ(k1, k2);
+    ASSERT_EQ(v1, v2);
+  }
+  EXPECT_FALSE(parallel.next(k2, v2));
+
+  for (int i = 0; i < kCount; ++i) {
+    ASSERT_TRUE(parallel.contains(i * 7));
+  }
+}
+
+TEST(HashMapParallel, ParallelForEachUpdatesValuesInPlace) {
+  HashMap<int, int> hm;
+  for (int i = 0; i < 1000; ++i) {
+    hm.insert(i, i);
+  }
+
+  atomic<int> visited{0};
+  hm.parallel_for_each(
+      [&](const int& key, int& value) {
+        value = key * 2;
+        visited++;
+      },
+      4);
+
+  EXPECT_EQ(visited.load(), 1000);
+  for (int i = 0; i < 1000; ++i) {
+    EXPECT_EQ(hm.at(i), i * 2);
+  }
+}
+
+TEST(HashMapParallel, ParallelReduceSumsAndIsDeterministic) {
+  HashMap<int, int> hm;
+  long long expected = 0;
+  for (int i = 0; i < 1000; ++i) {
+    hm.insert(i, i + 1);
+    expected += i + 1;
+  }
+
+  auto value = [](const int&, const int& v) {
+    return static_cast<long long>(v);
+  };
+  auto plus = [](long long a, long long b) { return a + b; };
+  EXPECT_EQ(hm.parallel_reduce(0LL, value, plus, 4), expected);
+  EXPECT_EQ(hm.parallel_reduce(10LL, value, plus, 1), expected + 10);
+
+  // Non-commutative combine: concatenation matches a serial fold
+  auto key = [](const int& k, const int&) { return to_string(k) + ","; };
+  auto concat = [](string a, string b) { return a + b; };
+  EXPECT_EQ(hm.parallel_reduce(string(), key, concat, 4),
+            hm.parallel_reduce(string(), key, concat, 1));
+}
+
+TEST(HashMapParallel, ParallelReduceOnEmptyMapReturnsInit) {
+  HashMap<int, int> hm;
+  int result = hm.parallel_reduce(
+      42, [](const int&, const int& v) { return v; },
+      [](int a, int b) { return a + b; }, 8);
+  EXPECT_EQ(result, 42);
+}
+
+TEST(HashMapMerge, MergeRelinksNewKeysAndCombinesDuplicates) {
+  HashMap<string, int> counts;
+  counts.insert("a", 1);
+  counts.insert("b", 2);
+
+  HashMap<string, int> other;
+  other.insert("b", 10);
+  other.insert("c", 20);
+  int* cValue = &other.at("c");
+
+  counts.merge(other, [](int mine, int theirs) { return mine + theirs; });
+
+  EXPECT_TRUE(other.empty());
+  EXPECT_FALSE(other.contains("c"));
+  EXPECT_EQ(counts.size(), static_cast<size_t>(3));
+  EXPECT_EQ(counts.at("a"), 1);
+  EXPECT_EQ(counts.at("b"), 12);
+  EXPECT_EQ(counts.at("c"), 20);
+  // The node was relinked, not copied
+  EXPECT_EQ(&counts.at("c"), cValue);
+
+  // Source stays usable
+  other.insert("d", 4);
+  EXPECT_EQ(other.at("d"), 4);
+}
+
+TEST(HashMapMerge, MergeGrowsAndSelfMergeIsNoOp) {
+  HashMap<int, int> hm;
+  HashMap<int, int> other;
+  for (int i = 0; i < 100; ++i) {
+    other.insert(i, i);
+  }
+  hm.merge(other, [](int a, int b) { return a + b; });
+  EXPECT_EQ(hm.size(), static_cast<size_t>(100));
+  EXPECT_LE(2 * hm.size(), 3 * hm.get_capacity());
+
+  hm.merge(hm, [](int a, int b) { return a + b; });
+  EXPECT_EQ(hm.size(), static_cast<size_t>(100));
+  EXPECT_EQ(hm.at(50), 50);
+}
+
+TEST(HashMapMerge, MergeParallelMatchesSequentialMerge) {
+  const int kMaps = 4;
+  vector<HashMap<int, string>> locals(kMaps);
+  vector<HashMap<int, string>> copies(kMaps);
+  Random::seed(11);
+  for (int m = 0; m < kMaps; ++m) {
+    for (int i = 0; i < 500; ++i) {
+      locals[m].insert(Random::randInt(800), to_string(m));
+    }
+    copies[m] = locals[m];
+  }
+
+  // Non-commutative combine checks source order is respected
+  auto concat = [](const string& a, const string& b) { return a + b; };
+
+  HashMap<int, string> expected;
+  expected.insert(0, "x");
+  for (int m = 0; m < kMaps; ++m) {
+    expected.merge(copies[m], concat);
+  }
+
+  HashMap<int, string> merged;
+  merged.insert(0, "x");
+  vector<HashMap<int, string>*> sources;
+  for (auto& local : locals) {
+    sources.push_back(&local);
+  }
+  merged.merge_parallel(sources, concat, 4);
+
+  EXPECT_TRUE(merged == expected);
+  for (auto& local : locals) {
+    EXPECT_TRUE(local.empty());
+  }
+}
+
+// Counts the mappings reachable through begin/next.
+size_t countByIteration(HashMap<int, int>& map) {
+  size_t visited = 0;
+  int key;
+  int value;
+  map.begin();
+  while (map.next(key, value)) {
+    visited++;
+  }
+  return visited;
+}
+
+TEST(HashMapMerge, ParallelMergeSizesForDistinctKeys) {
+  // Four word counts over the same vocabulary
+  vector<HashMap<int, int>> locals(4);
+  vector<HashMap<int, int>*> sources;
+  for (auto& local : locals) {
+    for (int word = 0; word < 10000; ++word) {
+      local.insert(word, 1);
+    }
+    sources.push_back(&local);
+  }
+  locals[0].insert(10000, 1);  // a few keys only one source has
+  locals[3].insert(11999, 1);
+  HashMap<int, int> expected;
+  for (int word = 0; word < 12000; ++word) {
+    expected.insert(word, 1);
+  }
+
+  HashMap<int, int> merged;
+  merged.merge_parallel(sources, plus<int>(), 4);
+  EXPECT_EQ(merged.size(), static_cast<size_t>(10002));
+  EXPECT_EQ(merged.at(7), 4);
+  EXPECT_EQ(merged.at(11999), 1);
+  EXPECT_LE(merged.get_capacity(), expected.get_capacity());
+
+  // Disjoint sources still grow the table as far as `insert` would
+  HashMap<int, int> low;
+  HashMap<int, int> high;
+  for (int i = 0; i < 6000; ++i) {
+    low.insert(i, i);
+    high.insert(i + 6000, i);
+  }
+  HashMap<int, int> disjoint;
+  disjoint.merge_parallel({&low, &high}, plus<int>(), 4);
+  EXPECT_EQ(disjoint.size(), static_cast<size_t>(12000));
+  EXPECT_EQ(disjoint.get_capacity(), expected.get_capacity());
+}
+
+TEST(HashMapMerge, ThrowingCombineLeavesEachNodeInOneMap) {
+  HashMap<int, int> hm;
+  HashMap<int, int> other;
+  for (int i = 0; i < 100; ++i) {
+    hm.insert(i, i);
+  }
+  for (int i = 50; i < 250; ++i) {
+    other.insert(i, i);
+  }
+
+  int calls = 0;
+  auto failOnTenth = [&calls](int a, int b) {
+    if (++calls == 10) {
+      throw runtime_error("combine failed");
+    }
+    return a + b;
+  };
+  EXPECT_THROW(hm.merge(other, failOnTenth), runtime_error);
+
+  EXPECT_EQ(countByIteration(hm), hm.size());
+  EXPECT_EQ(countByIteration(other), other.size());
+  EXPECT_FALSE(other.empty());
+  for (int i = 0; i < 250; ++i) {
+    EXPECT_TRUE(hm.contains(i) || other.contains(i)) << i;
+  }
+
+  // Finishing the merge moves the rest
+  hm.merge(other, [](int a, int) { return a; });
+  EXPECT_TRUE(other.empty());
+  EXPECT_EQ(hm.size(), static_cast<size_t>(250));
+  EXPECT_EQ(countByIteration(hm), hm.size());
+}
+
+TEST(HashMapMerge, ThrowingCombineInMergeParallelEmptiesSources) {
+  HashMap<int, int> hm;
+  for (int i = 0; i < 1000; ++i) {
+    hm.insert(i, i);
+  }
+  vector<HashMap<int, int>> locals(3);
+  vector<HashMap<int, int>*> sources;
+  for (int m = 0; m < 3; ++m) {
+    for (int i = 0; i < 1000; ++i) {
+      locals[m].insert(i * 3 + m, i);
+    }
+    sources.push_back(&locals[m]);
+  }
+
+  atomic<int> calls{0};
+  auto failOnce = [&calls](int a, int b) {
+    if (calls.fetch_add(1) == 200) {
+      throw runtime_error("combine failed");
+    }
+    return a + b;
+  };
+  EXPECT_THROW(hm.merge_parallel(sources, failOnce, 4), runtime_error);
+
+  // Unmerged nodes were destroyed (LeakSanitizer would report them)
+  for (auto& local : locals) {
+    EXPECT_TRUE(local.empty());
+    EXPECT_EQ(countByIteration(local), static_cast<size_t>(0));
+  }
+  EXPECT_EQ(countByIteration(hm), hm.size());
+  EXPECT_GE(hm.size(), static_cast<size_t>(1000));
+  hm.insert(-1, -1);
+  EXPECT_EQ(hm.at(-1), -1);
+}
+
+TEST(HashMapNodeHandle, ExtractAndInsertMovesNodeBetweenMaps) {
+  HashMap<int, string> hot;
+  HashMap<int, string> cold;
+  hot.insert(1, "one");
+  hot.insert(2, "two");
+  string* value = &hot.at(1);
+
+  auto nh = hot.extract(1);
+  ASSERT_FALSE(nh.empty());
+  EXPECT_EQ(nh.key(), 1);
+  EXPECT_EQ(nh.mapped(), "one");
+  EXPECT_FALSE(hot.contains(1));
+  EXPECT_EQ(hot.size(), static_cast<size_t>(1));
+
+  EXPECT_TRUE(cold.insert(std::move(nh)));
+  EXPECT_TRUE(nh.empty());
+  EXPECT_EQ(cold.size(), static_cast<size_t>(1));
+  EXPECT_EQ(cold.at(1), "one");
+  EXPECT_EQ(&cold.at(1), value);  // same node, no copy
+}
+
+TEST(HashMapNodeHandle, ExtractMissingKeyAndInsertDuplicate) {
+  HashMap<int, int> a;
+  HashMap<int, int> b;
+  a.insert(1, 10);
+  b.insert(1, 99);
+
+  EXPECT_TRUE(a.extract(2).empty());
+  EXPECT_FALSE(a.insert(HashMap<int, int>::node_type()));
+
+  auto nh = a.extract(1);
+  EXPECT_FALSE(b.insert(std::move(nh)));
+  ASSERT_FALSE(nh.empty());  // handle keeps the node
+  EXPECT_EQ(nh.mapped(), 10);
+  EXPECT_EQ(b.at(1), 99);
+  // nh frees the node when destroyed
+}
+
+TEST(HashMapNodeHandle, ExtractFromCollisionChain) {
+  HashMap<CollidingInt, int> hm(5);
+  CollidingInt a{1}, b{2}, c{3};
+  hm.insert(a, 100);
+  hm.insert(b, 200);
+  hm.insert(c, 300);
+
+  auto nh = hm.extract(b);
+  EXPECT_EQ(nh.mapped(), 200);
+  EXPECT_TRUE(hm.contains(a));
+  EXPECT_TRUE(hm.contains(c));
+  EXPECT_EQ(hm.size(), static_cast<size_t>(2));
+
+  EXPECT_TRUE(hm.insert(std::move(nh)));
+  EXPECT_EQ(hm.at(b), 200);
+}
+
+TEST(HashMapNodeHandle, SpliceMovesAllButExistingKeys) {
+  HashMap<int, int> dst;
+  HashMap<int, int> src;
+  dst.insert(5, 500);
+  for (int i = 0; i < 40; ++i) {
+    src.insert(i, i);
+  }
+  int* value = &src.at(7);
+
+  dst.splice(src);
+
+  EXPECT_EQ(dst.size(), static_cast<size_t>(40));
+  EXPECT_EQ(dst.at(5), 500);
+  EXPECT_EQ(&dst.at(7), value);
+  EXPECT_EQ(src.size(), static_cast<size_t>(1));
+  EXPECT_EQ(src.at(5), 5);
+  for (int i = 0; i < 40; ++i) {
+    EXPECT_TRUE(dst.contains(i));
+  }
+}
+
+TEST(HashMapFilter, RejectsErasedKeysWithoutWalkingChains) {
+  // Random keys, so that erased keys share buckets with surviving ones
+  vector<int> keys;
+  set<int> seen;
+  mt19937 rng(32);
+  while (keys.size() < 2000) {
+    int k = static_cast<int>(rng() % 1000000);
+    if (seen.insert(k).second) {
+      keys.push_back(k);
+    }
+  }
+
+  HashMap<CountedKey, int> plain;
+  HashMap<CountedKey, int> filtered;
+  filtered.set_filter(true);
+  EXPECT_TRUE(filtered.filter_enabled());
+  for (int k : keys) {
+    plain.insert(CountedKey{k}, k);
+    filtered.insert(CountedKey{k}, k);
+  }
+  for (size_t i = 0; i < keys.size(); i += 2) {
+    plain.erase(CountedKey{keys[i]});
+    filtered.erase(CountedKey{keys[i]});
+  }
+
+  // Erase recomputed each bucket's word, so lookups of the erased keys are
+  // mostly answered by the filter alone.
+  CountedKey::compares = 0;
+  for (size_t i = 0; i < keys.size(); i += 2) {
+    EXPECT_FALSE(plain.contains(CountedKey{keys[i]}));
+  }
+  size_t plainCompares = CountedKey::compares;
+  CountedKey::compares = 0;
+  for (size_t i = 0; i < keys.size(); i += 2) {
+    EXPECT_FALSE(filtered.contains(CountedKey{keys[i]}));
+    EXPECT_THROW(filtered.at(CountedKey{keys[i]}), out_of_range);
+  }
+  size_t filteredCompares = CountedKey::compares / 2;
+
+  EXPECT_GT(plainCompares, static_cast<size_t>(200));
+  EXPECT_LT(filteredCompares * 8, plainCompares);
+  for (size_t i = 1; i < keys.size(); i += 2) {
+    EXPECT_EQ(filtered.at(CountedKey{keys[i]}), keys[i]);
+  }
+}
+
+TEST(HashMapFilter, EnablingOnPopulatedMapAndCopying) {
+  HashMap<string, int> hm;
+  for (int i = 0; i < 100; ++i) {
+    hm.insert(to_string(i), i);
+  }
+  hm.set_filter(true);
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_TRUE(hm.contains(to_string(i)));
+    EXPECT_FALSE(hm.contains(to_string(i + 1000)));
+  }
+
+  HashMap<string, int> copy(hm);
+  EXPECT_TRUE(copy.filter_enabled());
+  EXPECT_EQ(copy.at("42"), 42);
+
+  HashMap<string, int> assigned;
+  assigned = hm;
+  EXPECT_TRUE(assigned.filter_enabled());
+  EXPECT_EQ(assigned.at("7"), 7);
+
+  hm.clear();
+  EXPECT_FALSE(hm.contains("42"));
+  hm.set_filter(false);
+  EXPECT_FALSE(hm.filter_enabled());
+  hm.insert("x", 1);
+  EXPECT_TRUE(hm.contains("x"));
+}
+
+TEST(HashMapFilter, FilterFollowsNodesAcrossMaps) {
+  HashMap<int, int> a;
+  HashMap<int, int> b;
+  a.set_filter(true);
+  b.set_filter(true);
+  for (int i = 0; i < 50; ++i) {
+    a.insert(i, i);
+    b.insert(i + 25, i);
+  }
+
+  auto nh = a.extract(10);
+  EXPECT_FALSE(a.contains(10));
+  HashMap<int, int> c;
+  c.set_filter(true);
+  EXPECT_TRUE(c.insert(std::move(nh)));
+  EXPECT_TRUE(c.contains(10));
+
+  c.splice(b);  // moves everything; b ends up empty
+  EXPECT_TRUE(b.empty());
+  for (int i = 25; i < 75; ++i) {
+    EXPECT_TRUE(c.contains(i));
+    EXPECT_FALSE(b.contains(i));
+  }
+
+  a.merge(c, [](int x, int) { return x; });
+  for (int i = 0; i < 75; ++i) {
+    EXPECT_TRUE(a.contains(i));
+  }
+
+  vector<pair<int, int>> more;
+  for (int i = 100; i < 400; ++i) {
+    more.push_back({i, i});
+  }
+  a.build_parallel(more, 3);
+  for (int i = 100; i < 400; ++i) {
+    EXPECT_TRUE(a.contains(i));
+  }
+}
+
+TEST(HashMapColumnar, BasicOperations) {
+  ColumnarHashMap<int, string> hm;
+  EXPECT_TRUE(hm.empty());
+  EXPECT_EQ(hm.get_capacity(), static_cast<size_t>(10));
+
+  hm.insert(1, "one");
+  hm.insert(2, "two");
+  hm.insert(1, "uno");  // should NOT overwrite
+
+  EXPECT_EQ(hm.size(), static_cast<size_t>(2));
+  EXPECT_EQ(hm.at(1), "one");
+  EXPECT_TRUE(hm.contains(2));
+  EXPECT_FALSE(hm.contains(3));
+  EXPECT_THROW(hm.at(3), out_of_range);
+  EXPECT_THROW(hm.erase(3), out_of_range);
+
+  EXPECT_EQ(hm.erase(1), "one");
+  EXPECT_FALSE(hm.contains(1));
+  EXPECT_EQ(hm.at(2), "two");
+
+  hm.clear();
+  EXPECT_TRUE(hm.empty());
+  EXPECT_FALSE(hm.contains(2));
+}
+
+// Erases from one long chain and checks which entry filled each hole.
+template <typename Map>
+void checkEraseMovesLastEntry() {
+  Map hm;  // one chain holds every key
+  for (int i = 0; i < 10; ++i) {
+    hm.insert(CollidingInt{i}, i * 10);
+  }
+  EXPECT_EQ(hm.erase(CollidingInt{3}), 30);
+  // The last entry now sits where 3 was, and is still reachable
+  EXPECT_EQ(hm.erase(CollidingInt{9}), 90);
+  EXPECT_EQ(hm.erase(CollidingInt{8}), 80);
+
+  // begin/next walks storage order, so it shows where entries live
+  vector<int> order;
+  CollidingInt k;
+  int v;
+  hm.begin();
+  while (hm.next(k, v)) {
+    EXPECT_EQ(v, k.value * 10);
+    order.push_back(k.value);
+  }
+  EXPECT_EQ(order, (vector<int>{0, 1, 2, 7, 4, 5, 6}));
+  for (int i = 0; i < 10; ++i) {
+    bool kept = i != 3 && i != 8 && i != 9;
+    EXPECT_EQ(hm.contains(CollidingInt{i}), kept) << i;
+  }
+}
+
+TEST(HashMapColumnar, EraseMovesLastEntryIntoTheHole) {
+  checkEraseMovesLastEntry<ColumnarHashMap<CollidingInt, int>>();
+  checkEraseMovesLastEntry<CompactHashMap<CollidingInt, int>>();
+}
+
+TEST(HashMapColumnar, BeginNextVisitsEveryMappingAfterErase) {
+  ColumnarHashMap<int, int> hm;
+  for (int i = 0; i < 30; ++i) {
+    hm.insert(i, i * 10);
+  }
+  hm.erase(0);
+  hm.erase(15);
+
+  set<pair<int, int>> seen;
+  int k, v;
+  hm.begin();
+  while (hm.next(k, v)) {
+    seen.insert({k, v});
+  }
+  EXPECT_EQ(seen.size(), static_cast<size_t>(28));
+  EXPECT_EQ(seen.count({0, 0}), static_cast<size_t>(0));
+  EXPECT_EQ(seen.count({29, 290}), static_cast<size_t>(1));
+}
+
+TEST(HashMapCoroutine, AsyncLookupsMatchSyncLookups) {
+  HashMap<int, int> hm;
+  for (int i = 0; i < 200; i += 2) {
+    hm.insert(i, i * 10);
+  }
+
+  // Two independent streams of lookups interleaved by one scheduler
+  vector<LookupTask<bool>> hits;
+  vector<LookupTask<int&>> values;
+  LookupScheduler scheduler(8);
+  for (int i = 0; i < 200; ++i) {
+    hits.push_back(hm.contains_async(i, &scheduler));
+  }
+  for (int i = 0; i < 200; i += 2) {
+    values.push_back(hm.at_async(i, &scheduler));
+  }
+  for (auto& t : hits) {
+    scheduler.submit(t);
+  }
+  for (auto& t : values) {
+    scheduler.submit(t);
+  }
+  scheduler.run();
+
+  for (int i = 0; i < 200; ++i) {
+    ASSERT_TRUE(hits[i].done());
+    EXPECT_EQ(hits[i].get(), i % 2 == 0);
+  }
+  for (int i = 0; i < 100; ++i) {
+    int& v = values[i].get();
+    EXPECT_EQ(v, i * 20);
+    EXPECT_EQ(&v, &hm.at(i * 2));
+  }
+}
+
+TEST(HashMapCoroutine, AtAsyncThrowsForMissingKeyAndGetRunsInline) {
+  HashMap<CollidingInt, string> hm(3);
+  hm.set_filter(true);
+  hm.insert(CollidingInt{1}, "a");
+  hm.insert(CollidingInt{2}, "b");
+
+  // No scheduler: get() drives the lookup itself
+  EXPECT_EQ(hm.at_async(CollidingInt{1}).get(), "a");
+  EXPECT_TRUE(hm.contains_async(CollidingInt{2}).get());
+  EXPECT_FALSE(hm.contains_async(CollidingInt{3}).get());
+
+  auto missing = hm.at_async(CollidingInt{3});
+  LookupScheduler scheduler;
+  scheduler.submit(missing);
+  scheduler.run();
+  EXPECT_THROW(missing.get(), out_of_range);
+}
+
+TEST(HashMapCoroutine, SchedulerSkipsFinishedTasks) {
+  HashMap<int, int> hm;
+  hm.insert(1, 10);
+  LookupScheduler scheduler;
+
+  auto gotten = hm.contains_async(1, &scheduler);
+  EXPECT_TRUE(gotten.get());
+  auto ranTwice = hm.at_async(1, &scheduler);
+  auto moved = hm.contains_async(2, &scheduler);
+  auto kept = std::move(moved);
+
+  // Finished before submit, moved from, and submitted twice
+  scheduler.submit(gotten);
+  scheduler.submit(moved);
+  scheduler.submit(ranTwice);
+  scheduler.submit(ranTwice);
+  scheduler.submit(kept);
+  scheduler.run();
+  EXPECT_EQ(ranTwice.get(), 10);
+  EXPECT_FALSE(kept.get());
+
+  // Finished between submit and run
+  auto early = hm.contains_async(1, &scheduler);
+  scheduler.submit(early);
+  EXPECT_TRUE(early.get());
+  scheduler.run();
+  EXPECT_TRUE(early.get());
+}
+
+TEST(HashMapCoroutine, SchedulerReusesFrames) {
+  HashMap<int, int> hm;
+  for (int i = 0; i < 100; i++) {
+    hm.insert(i, i);
+  }
+  LookupScheduler scheduler(4);
+
+  auto runBatch = [&](int first) {
+    vector<LookupTask<bool>> tasks;
+    for (int i = first; i < first + 32; i++) {
+      tasks.push_back(hm.contains_async(i, &scheduler));
+    }
+    for (auto& t : tasks) {
+      scheduler.submit(t);
+    }
+    scheduler.run();
+    for (int i = 0; i < 32; i++) {
+      EXPECT_EQ(tasks[i].get(), first + i < 100);
+    }
+  };
+  runBatch(0);
+  size_t frames = scheduler.get_frame_count();
+  EXPECT_EQ(frames, static_cast<size_t>(32));
+  runBatch(80);
+  runBatch(40);
+  EXPECT_EQ(scheduler.get_frame_count(), frames);
+}
+
+TEST(HashMapCoroutine, TasksMayOutliveTheirScheduler) {
+  HashMap<int, string> hm;
+  hm.insert(1, "one");
+  vector<LookupTask<string&>> tasks;
+  {
+    LookupScheduler scheduler;
+    tasks.push_back(hm.at_async(1, &scheduler));
+    tasks.push_back(hm.at_async(2, &scheduler));
+    scheduler.submit(tasks[0]);
+    scheduler.run();
+  }
+  EXPECT_EQ(tasks[0].get(), "one");
+  EXPECT_THROW(tasks[1].get(), out_of_range);
+  tasks.clear();
+}
+
+TEST(HashMapSnapshot, SnapshotIsUnaffectedByLaterWrites) {
+  SnapshotHashMap<int, string> hm;
+  hm.insert(1, "one");
+  hm.insert(2, "two");
+
+  auto snap = hm.snapshot();
+  hm.insert(3, "three");
+  EXPECT_EQ(hm.erase(1), "one");
+  hm.insert(1, "uno");
+
+  EXPECT_EQ(snap.size(), static_cast<size_t>(2));
+  EXPECT_EQ(snap.at(1), "one");
+  EXPECT_FALSE(snap.contains(3));
+  EXPECT_THROW(snap.at(3), out_of_range);
+
+  EXPECT_EQ(hm.size(), static_cast<size_t>(3));
+  EXPECT_EQ(hm.at(1), "uno");
+  EXPECT_EQ(hm.at(3), "three");
+  EXPECT_THROW(hm.erase(4), out_of_range);
+}
+
+TEST(HashMapSnapshot, EraseInSharedChainCopiesOnlyThePrefix) {
+  SnapshotHashMap<CollidingInt, int> hm(4);
+  for (int i = 0; i < 5; ++i) {
+    hm.insert(CollidingInt{i}, i * 10);
+  }
+  const int* tail = &hm.at(CollidingInt{0});  // last node in the chain
+
+  auto snap = hm.snapshot();
+  EXPECT_EQ(hm.erase(CollidingInt{2}), 20);
+
+  // The suffix after the erased node is still shared
+  EXPECT_EQ(&hm.at(CollidingInt{0}), tail);
+  EXPECT_EQ(&snap.at(CollidingInt{0}), tail);
+  EXPECT_FALSE(hm.contains(CollidingInt{2}));
+  EXPECT_TRUE(snap.contains(CollidingInt{2}));
+  for (int i : {0, 1, 3, 4}) {
+    EXPECT_EQ(hm.at(CollidingInt{i}), i * 10);
+  }
+}
+
+TEST(HashMapSnapshot, SnapshotsSurviveResizeAndClear) {
+  SnapshotHashMap<int, int> hm;
+  vector<SnapshotHashMap<int, int>::Snapshot> snaps;
+  for (int i = 0; i < 20000; ++i) {
+    hm.insert(i, i);
+    if (i % 5000 == 0) {
+      snaps.push_back(hm.snapshot());
+    }
+  }
+  EXPECT_GT(hm.get_capacity(), static_cast<size_t>(10000));  // deep tree
+
+  hm.clear();
+  EXPECT_TRUE(hm.empty());
+  EXPECT_FALSE(hm.contains(0));
+
+  for (size_t s = 0; s < snaps.size(); ++s) {
+    int expected = static_cast<int>(s) * 5000 + 1;
+    EXPECT_EQ(snaps[s].size(), static_cast<size_t>(expected));
+    long long sum = 0;
+    snaps[s].for_each([&](const int& k, const int& v) { sum += k - v + 1; });
+    EXPECT_EQ(sum, expected);
+    EXPECT_TRUE(snaps[s].contains(expected - 1));
+    EXPECT_FALSE(snaps[s].contains(expected));
+  }
+}
+
+TEST(HashMapSnapshot, ReaderThreadUsesSnapshotWhileWriterMutates) {
+  SnapshotHashMap<int, int> hm;
+  for (int i = 0; i < 2000; ++i) {
+    hm.insert(i, i * 2);
+  }
+  auto snap = hm.snapshot();
+
+  atomic<int> bad{0};
+  thread reader([&]() {
+    for (int round = 0; round < 5; ++round) {
+      for (int i = 0; i < 2000; ++i) {
+        if (!snap.contains(i) || snap.at(i) != i * 2) {
+          bad++;
+        }
+      }
+    }
+  });
+
+  for (int i = 0; i < 2000; i += 2) {
+    hm.erase(i);
+  }
+  for (int i = 2000; i < 6000; ++i) {
+    hm.insert(i, -i);
+  }
+  reader.join();
+
+  EXPECT_EQ(bad.load(), 0);
+  EXPECT_EQ(hm.size(), static_cast<size_t>(5000));
+  EXPECT_EQ(snap.size(), static_cast<size_t>(2000));
+}
+
+TEST(HashMapSnapshot, CopiesNeverWriteToSharedPages) {
+  SnapshotHashMap<int, int> a;
+  for (int i = 0; i < 1000; ++i) {
+    a.insert(i, i);
+  }
+  SnapshotHashMap<int, int> b(a);
+  SnapshotHashMap<int, int> c;
+  c = b;
+  for (int i = 0; i < 1000; i += 3) {
+    a.erase(i);
+    b.insert(i + 1000, 0);
+  }
+  for (int i = 0; i < 1000; i += 3) {
+    EXPECT_FALSE(a.contains(i));
+    EXPECT_TRUE(b.contains(i));
+    EXPECT_TRUE(c.contains(i));
+    EXPECT_FALSE(a.contains(i + 1000));
+    EXPECT_TRUE(b.contains(i + 1000));
+    EXPECT_FALSE(c.contains(i + 1000));
+  }
+  EXPECT_EQ(c.size(), static_cast<size_t>(1000));
+
+  // Pages of a snapshot released on another thread are copied too, never
+  // reused in place.
+  auto snap = a.snapshot();
+  thread([s = std::move(snap)]() mutable {
+    EXPECT_FALSE(s.contains(0));
+    s = SnapshotHashMap<int, int>().snapshot();
+  }).join();
+  a.insert(0, 1);
+  EXPECT_EQ(a.at(0), 1);
+}
+
+// Creates a fresh, empty directory for a durable map.
+string makeTempDir() {
+  char path[] = "/tmp/hashmap_wal_XXXXXX";
+  return string(mkdtemp(path));
+}
+
+void removeDir(const string& dir) {
+  unlink((dir + "/wal.log").c_str());
+  unlink((dir + "/wal.log.tmp").c_str());
+  unlink((dir + "/checkpoint").c_str());
+  unlink((dir + "/checkpoint.tmp").c_str());
+  rmdir(dir.c_str());
+}
+
+long fileSize(const string& path) {
+  ifstream in(path, ios::binary | ios::ate);
+  return in ? static_cast<long>(in.tellg()) : -1;
+}
+
+TEST(HashMapDurable, RecoversInsertsAndErasesFromLog) {
+  string dir = makeTempDir();
+  {
+    DurableHashMap<int, string> hm(dir);
+    hm.insert(1, "one");
+    hm.insert(2, "two");
+    hm.insert(3, "three");
+    hm.insert(1, "uno");  // not logged, not applied
+    EXPECT_EQ(hm.erase(2), "two");
+    EXPECT_THROW(hm.erase(2), out_of_range);
+  }
+  {
+    DurableHashMap<int, string> hm(dir);
+    EXPECT_EQ(hm.size(), static_cast<size_t>(2));
+    EXPECT_EQ(hm.at(1), "one");
+    EXPECT_EQ(hm.at(3), "three");
+    EXPECT_FALSE(hm.contains(2));
+  }
+  removeDir(dir);
+}
+
+TEST(HashMapDurable, CheckpointTruncatesLogAndRecovers) {
+  string dir = makeTempDir();
+  {
+    DurableHashMap<string, int> hm(dir);
+    for (int i = 0; i < 100; ++i) {
+      hm.insert("k" + to_string(i), i);
+    }
+    EXPECT_GT(fileSize(dir + "/wal.log"), 0);
+    hm.checkpoint();
+    EXPECT_EQ(fileSize(dir + "/wal.log"), 0);
+    hm.erase("k5");
+    hm.insert("extra", -1);
+  }
+  {
+    DurableHashMap<string, int> hm(dir);
+    EXPECT_EQ(hm.size(), static_cast<size_t>(100));
+    EXPECT_FALSE(hm.contains("k5"));
+    EXPECT_EQ(hm.at("k99"), 99);
+    EXPECT_EQ(hm.at("extra"), -1);
+  }
+  removeDir(dir);
+}
+
+TEST(HashMapDurable, TornTailIsDiscarded) {
+  string dir = makeTempDir();
+  {
+    DurableHashMap<int, int> hm(dir);
+    hm.insert(1, 10);
+    hm.insert(2, 20);
+  }
+  long goodSize = fileSize(dir + "/wal.log");
+  {
+    // A record cut short by a crash
+    ofstream log(dir + "/wal.log", ios::binary | ios::app);
+    log.write("\x09\x00\x00\x00\x01\x02", 6);
+  }
+  {
+    DurableHashMap<int, int> hm(dir);
+    EXPECT_EQ(hm.size(), static_cast<size_t>(2));
+    EXPECT_EQ(fileSize(dir + "/wal.log"), goodSize);
+    hm.insert(3, 30);
+  }
+  {
+    DurableHashMap<int, int> hm(dir);
+    EXPECT_EQ(hm.size(), static_cast<size_t>(3));
+    EXPECT_EQ(hm.at(3), 30);
+  }
+  removeDir(dir);
+}
+
+TEST(HashMapDurable, ConcurrentWritersShareGroupCommits) {
+  string dir = makeTempDir();
+  {
+    DurableHashMap<int, int> hm(dir);
+    vector<thread> writers;
+    for (int t = 0; t < 4; ++t) {
+      writers.emplace_back([&hm, t]() {
+        for (int i = 0; i < 50; ++i) {
+          hm.insert(t * 1000 + i, i);
+        }
+      });
+    }
+    for (thread& w : writers) {
+      w.join();
+    }
+    EXPECT_EQ(hm.size(), static_cast<size_t>(200));
+    EXPECT_LT(hm.get_commit_count(), static_cast<size_t>(200));
+  }
+  {
+    DurableHashMap<int, int> hm(dir);
+    EXPECT_EQ(hm.size(), static_cast<size_t>(200));
+    EXPECT_EQ(hm.at(3049), 49);
+  }
+  removeDir(dir);
+}
+
+TEST(HashMapDurable, WriteFailureFailsTheMap) {
+  string dir = makeTempDir();
+  {
+    DurableHashMap<int, int> hm(dir);
+    hm.insert(1, 10);
+
+    // Cap file size at the log's current size, so the next append fails.
+    rlimit saved;
+    getrlimit(RLIMIT_FSIZE, &saved);
+    rlimit capped = saved;
+    capped.rlim_cur = static_cast<rlim_t>(fileSize(dir + "/wal.log"));
+    auto savedHandler = signal(SIGXFSZ, SIG_IGN);
+    setrlimit(RLIMIT_FSIZE, &capped);
+    EXPECT_THROW(hm.insert(2, 20), runtime_error);
+    setrlimit(RLIMIT_FSIZE, &saved);
+    signal(SIGXFSZ, savedHandler);
+
+    // The failed insert is in memory but not on disk: nothing may use it.
+    EXPECT_THROW(hm.contains(2), runtime_error);
+    EXPECT_THROW(hm.insert(3, 30), runtime_error);
+    EXPECT_THROW(hm.erase(1), runtime_error);
+    EXPECT_THROW(hm.checkpoint(), runtime_error);
+  }
+  {
+    DurableHashMap<int, int> hm(dir);
+    EXPECT_EQ(hm.size(), static_cast<size_t>(1));
+    EXPECT_EQ(hm.at(1), 10);
+  }
+  removeDir(dir);
+}
+
+TEST(HashMapDurable, AsyncWritesAndAutomaticCheckpoint) {
+  string dir = makeTempDir();
+  DurabilityOptions options;
+  options.sync_writes = false;
+  options.checkpoint_log_bytes = 512;
+  {
+    DurableHashMap<int, int> hm(dir, options);
+    for (int i = 0; i < 5000; ++i) {
+      hm.insert(i, i * i);
+      if (i % 50 == 0) {
+        hm.sync();  // small batches, so the log crosses the threshold often
+      }
+    }
+    hm.sync();
+    // The threshold grows with the checkpoint, so rewrites stay rare
+    size_t checkpoints = hm.get_checkpoint_count();
+    EXPECT_GT(checkpoints, 0u);
+    EXPECT_LT(checkpoints, 20u);
+  }
+  EXPECT_GT(fileSize(dir + "/checkpoint"), 0);
+  EXPECT_LE(fileSize(dir + "/wal.log"), fileSize(dir + "/checkpoint") + 4096);
+  {
+    DurableHashMap<int, int> hm(dir, options);
+    EXPECT_EQ(hm.size(), static_cast<size_t>(5000));
+    EXPECT_EQ(hm.at(4999), 4999 * 4999);
+  }
+  removeDir(dir);
+}
+
+TEST(HashMapDurable, WritesDuringCheckpointsAreKept) {
+  string dir = makeTempDir();
+  {
+    DurableHashMap<int, int> hm(dir);
+    atomic<bool> done{false};
+    thread checkpointer([&]() {
+      while (!done) {
+        hm.checkpoint();
+      }
+    });
+    for (int i = 0; i < 300; ++i) {
+      hm.insert(i, i);
+      if (i % 3 == 0) {
+        hm.erase(i);
+      }
+    }
+    done = true;
+    checkpointer.join();
+    EXPECT_GT(hm.get_checkpoint_count(), 0u);
+  }
+  {
+    DurableHashMap<int, int> hm(dir);
+    EXPECT_EQ(hm.size(), static_cast<size_t>(200));
+    for (int i = 0; i < 300; ++i) {
+      ASSERT_EQ(hm.contains(i), i % 3 != 0) << i;
+    }
+  }
+  removeDir(dir);
+}
+
+// Returns the first number in file `path`, or 0 if it cannot be read.
+long readSysNumber(const string& path) {
+  ifstream in(path);
+  long value = 0;
+  return in >> value ? value : 0;
+}
+
+// Returns the kB of transparent huge pages backing [p, p + len), from the
+// AnonHugePages lines of /proc/self/smaps.
+long hugeKbIn(const void* p, size_t len) {
+  uintptr_t lo = reinterpret_cast<uintptr_t>(p);
+  uintptr_t hi = lo + len;
+  ifstream smaps("/proc/self/smaps");
+  string line;
+  bool inside = false;
+  long kb = 0;
+  while (getline(smaps, line)) {
+    uintptr_t start;
+    uintptr_t end;
+    if (sscanf(line.c_str(), "%lx-%lx ", &start, &end) == 2) {
+      inside = start < hi && lo < end;
+    } else if (inside && line.rfind("AnonHugePages:", 0) == 0) {
+      kb += atol(line.c_str() + strlen("AnonHugePages:"));
+    }
+  }
+  return kb;
+}
+
+TEST(HashMapMemoryPolicy, HugePageBackingsBehaveLikeDefault) {
+  for (PageBacking pages :
+       {PageBacking::kTransparentHuge, PageBacking::kHuge2M,
+        PageBacking::kHuge1G}) {
+    // Even a small table would take a whole reserved 1 GB page
+    if (pages == PageBacking::kHuge1G &&
+        readSysNumber("/sys/kernel/mm/hugepages/hugepages-1048576kB/"
+                      "free_hugepages") > 0) {
+      continue;
+    }
+    MemoryPolicy policy;
+    policy.pages = pages;
+    policy.min_bytes = 0;
+
+    HashMap<int, int> hm;
+    hm.set_memory_policy(policy);
+    for (int i = 0; i < 5000; ++i) {
+      hm.insert(i, -i);
+    }
+    for (int i = 0; i < 5000; i += 2) {
+      EXPECT_EQ(hm.erase(i), -i);
+    }
+    EXPECT_EQ(hm.size(), static_cast<size_t>(2500));
+    EXPECT_EQ(hm.at(4999), -4999);
+    EXPECT_FALSE(hm.contains(4998));
+
+    HashMap<int, int> copy(hm);
+    EXPECT_EQ(copy.get_memory_policy().pages, pages);
+    EXPECT_TRUE(copy == hm);
+    HashMap<int, int> assigned;
+    assigned = hm;
+    EXPECT_TRUE(assigned == hm);
+  }
+}
+
+TEST(HashMapMemoryPolicy, TransparentHugePagesBackTheArray) {
+  ifstream thp("/sys/kernel/mm/transparent_hugepage/enabled");
+  string modes;
+  getline(thp, modes);
+  if (modes.find("[never]") != string::npos || modes.empty()) {
+    GTEST_SKIP() << "transparent huge pages are disabled";
+  }
+
+  MemoryPolicy policy;
+  policy.pages = PageBacking::kTransparentHuge;
+  size_t bytes = size_t(8) << 20;
+  size_t mapped;
+  void* p = mapBucketMemory(bytes, policy, mapped);
+  ASSERT_NE(p, nullptr);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(p) % (size_t(2) << 20), 0u);
+  memset(p, 1, bytes);
+  // Each 2 MB page replaces 512 TLB entries for 4 KB pages
+  EXPECT_GT(hugeKbIn(p, mapped), 0);
+  unmapBucketMemory(p, mapped);
+}
+
+TEST(HashMapMemoryPolicy, NumaPlacementWithParallelRehash) {
+  MemoryPolicy policy;
+  policy.pages = PageBacking::kTransparentHuge;
+  policy.numa = NumaPlacement::kInterleave;
+  policy.node_mask = 1;
+  policy.min_bytes = 0;
+
+  HashMap<int, int> hm;
+  hm.set_memory_policy(policy);
+  hm.set_rehash_threads(4);
+  for (int i = 0; i < 200000; ++i) {
+    hm.insert(i, i);
+  }
+  EXPECT_EQ(hm.size(), static_cast<size_t>(200000));
+  EXPECT_EQ(hm.at(123456), 123456);
+
+  // Switching back moves the buckets to the heap
+  hm.set_memory_policy(MemoryPolicy());
+  EXPECT_EQ(hm.at(199999), 199999);
+  hm.clear();
+  EXPECT_TRUE(hm.empty());
+}
+
+TEST(HashMapBatch, KernelsMatchScalarModulo) {
+  mt19937_64 rng(38);
+  vector<size_t> hashes(1000);
+  for (size_t i = 0; i < hashes.size(); ++i) {
+    // 32-bit runs for fastmod, and wide hashes for Barrett reduction
+    hashes[i] = i < 500 && i % 37 != 0 ? rng() & UINT32_MAX : rng();
+  }
+  vector<size_t> edges = {UINT64_MAX, UINT64_MAX - 1, size_t(1) << 32,
+                          (size_t(1) << 32) - 1, size_t(1) << 63};
+  copy(edges.begin(), edges.end(), hashes.begin() + 700);
+  vector<size_t> divisors = {1,          2,          3,
+                             10,         1 << 20,    1000003,
+                             UINT32_MAX, (size_t(1) << 32) + 7};
+
+  using Kernel = void (*)(const size_t*, size_t, size_t, size_t*);
+  vector<Kernel> kernels = {bucketIndices};
+#ifdef HASHMAP_X86_KERNELS
+  if (__builtin_cpu_supports("avx2")) {
+    kernels.push_back(bucketIndicesAvx2);
+  }
+  if (__builtin_cpu_supports("avx512f")) {
+    kernels.push_back(bucketIndicesAvx512);
+  }
+#endif
+
+  for (Kernel kernel : kernels) {
+    for (size_t d : divisors) {
+      vector<size_t> out(hashes.size());
+      // Odd length exercises the tail handling
+      kernel(hashes.data(), hashes.size() - 3, d, out.data());
+      for (size_t i = 0; i + 3 < hashes.size(); ++i) {
+        ASSERT_EQ(out[i], hashes[i] % d) << "d=" << d << " i=" << i;
+      }
+    }
+  }
+}
+
+TEST(HashMapBatch, InsertRangeMatchesInsert) {
+  mt19937 rng(380);
+  vector<pair<uint64_t, int>> pairs;
+  for (int i = 0; i < 5000; ++i) {
+    pairs.push_back({rng() % 3000, i});  // duplicates: first one wins
+  }
+
+  HashMap<uint64_t, int> expected;
+  expected.insert(7, -1);
+  for (const auto& p : pairs) {
+    expected.insert(p.first, p.second);
+  }
+  HashMap<uint64_t, int> hm;
+  hm.insert(7, -1);
+  hm.insert_range(pairs);
+
+  EXPECT_EQ(hm.size(), expected.size());
+  // Duplicates must not grow the table past what `insert` would
+  EXPECT_EQ(hm.get_capacity(), expected.get_capacity());
+  for (const auto& p : pairs) {
+    EXPECT_EQ(hm.at(p.first), expected.at(p.first));
+  }
+  EXPECT_EQ(hm.at(7), -1);
+
+  HashMap<uint64_t, int> fromEmpty(0);
+  fromEmpty.insert_range(pairs);
+  HashMap<uint64_t, int> sequential(0);
+  for (const auto& p : pairs) {
+    sequential.insert(p.first, p.second);
+  }
+  EXPECT_EQ(fromEmpty.get_capacity(), sequential.get_capacity());
+}
+
+TEST(HashMapBatch, InsertRangeRehashesSmallTablesSerially) {
+  vector<pair<ThreadTrackedKey, int>> pairs;
+  for (int i = 0; i < 5000; ++i) {
+    pairs.push_back({ThreadTrackedKey{i}, i});
+  }
+  HashMap<ThreadTrackedKey, int> hm(1);
+  hm.set_rehash_threads(4);
+  ThreadTrackedKey::threads.clear();
+  hm.insert_range(pairs);
+
+  // Every doubling stayed below the parallel rehash threshold
+  EXPECT_EQ(hm.size(), pairs.size());
+  EXPECT_EQ(ThreadTrackedKey::threads, set<thread::id>{this_thread::get_id()});
+}
+
+TEST(HashMapBatch, ContainsManyMatchesContains) {
+  HashMap<string, int> hm;
+  hm.set_filter(true);
+  vector<pair<string, int>> pairs;
+  for (int i = 0; i < 1000; ++i) {
+    pairs.push_back({"key" + to_string(i * 2), i});
+  }
+  hm.insert_range(pairs);
+
+  vector<string> probes;
+  for (int i = 0; i < 2100; ++i) {
+    probes.push_back("key" + to_string(i));
+  }
+  vector<uint8_t> found = hm.contains_many(probes);
+  ASSERT_EQ(found.size(), probes.size());
+  for (size_t i = 0; i < probes.size(); ++i) {
+    EXPECT_EQ(found[i] != 0, hm.contains(probes[i])) << probes[i];
+  }
+  HashMap<string, int> empty;
+  EXPECT_TRUE(empty.contains_many(vector<string>()).empty());
+}
+
+TEST(HashMapBulkErase, EraseIfRemovesMatchesInOnePass) {
+  HashMap<int, int> hm;
+  hm.set_filter(true);
+  for (int i = 0; i < 10000; ++i) {
+    hm.insert(i, i % 10);
+  }
+
+  size_t removed =
+      hm.erase_if([](const int&, const int& value) { return value < 3; });
+  EXPECT_EQ(removed, static_cast<size_t>(3000));
+  EXPECT_EQ(hm.size(), static_cast<size_t>(7000));
+  for (int i = 0; i < 10000; ++i) {
+    EXPECT_EQ(hm.contains(i), i % 10 >= 3) << i;
+  }
+  EXPECT_EQ(hm.erase_if([](const int&, const int&) { return false; }),
+            static_cast<size_t>(0));
+
+  size_t visited = 0;
+  int key;
+  int value;
+  hm.begin();
+  while (hm.next(key, value)) {
+    visited++;
+  }
+  EXPECT_EQ(visited, static_cast<size_t>(7000));
+}
+
+TEST(HashMapBulkErase, RetainKeepsMatches) {
+  HashMap<string, int> hm;
+  for (int i = 0; i < 100; ++i) {
+    hm.insert("k" + to_string(i), i);
+  }
+  auto shortKey = [](const string& key, const int&) {
+    return key.size() == 2;
+  };
+  EXPECT_EQ(hm.retain(shortKey), static_cast<size_t>(90));
+  EXPECT_EQ(hm.size(), static_cast<size_t>(10));
+  EXPECT_EQ(hm.at("k7"), 7);
+  EXPECT_FALSE(hm.contains("k42"));
+}
+
+TEST(HashMapBulkErase, ShrinkToFitAfterEviction) {
+  HashMap<int, int> hm;
+  for (int i = 0; i < 10000; ++i) {
+    hm.insert(i, i);
+  }
+  EXPECT_EQ(hm.get_capacity(), static_cast<size_t>(10240));
+  hm.erase_if([](const int& key, const int&) { return key >= 100; });
+  hm.shrink_to_fit();
+  // 10240 halves down to 160 (load 0.625); 80 would be 1.25, above 0.75
+  EXPECT_EQ(hm.get_capacity(), static_cast<size_t>(160));
+  hm.shrink_to_fit();
+  EXPECT_EQ(hm.get_capacity(), static_cast<size_t>(160));
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_EQ(hm.at(i), i);
+  }
+
+  // Inserting back up to the old count still works
+  for (int i = 100; i < 200; ++i) {
+    hm.insert(i, i);
+  }
+  EXPECT_EQ(hm.size(), static_cast<size_t>(200));
+
+  hm.clear();
+  hm.shrink_to_fit();
+  EXPECT_EQ(hm.get_capacity(), static_cast<size_t>(1));
+  hm.insert(1, 1);
+  EXPECT_EQ(hm.at(1), 1);
+}
+
+TEST(HashMapString, InlineKeysOfAnyLength) {
+  StringHashMap<int> hm;
+  string longKey = "https://example.com/" + string(200, 'x');
+  hm.insert("", 0);
+  hm.insert("a", 1);
+  hm.insert(longKey, 2);
+  hm.insert("a", 99);  // does not overwrite
+
+  EXPECT_EQ(hm.size(), static_cast<size_t>(3));
+  EXPECT_EQ(hm.at(""), 0);
+  EXPECT_EQ(hm.at("a"), 1);
+  EXPECT_EQ(hm.at(longKey), 2);
+  EXPECT_FALSE(hm.contains(longKey.substr(1)));
+  EXPECT_THROW(hm.at("b"), out_of_range);
+
+  // Lookups by view need not build a string
+  string_view buffer = "xxaxx";
+  EXPECT_TRUE(hm.contains(buffer.substr(2, 1)));
+
+  hm.at("a") = 10;
+  EXPECT_EQ(hm.erase("a"), 10);
+  EXPECT_THROW(hm.erase("a"), out_of_range);
+  EXPECT_EQ(hm.size(), static_cast<size_t>(2));
+}
+
+TEST(HashMapString, CopiesAndForEachAfterResizes) {
+  StringHashMap<int> hm;
+  HashMap<string, int> expected;
+  mt19937 rng(40);
+  for (int i = 0; i < 3000; ++i) {
+    string key = "/path/" + to_string(rng() % 2000) + string(rng() % 40, 'q');
+    hm.insert(key, i);
+    expected.insert(key, i);
+  }
+  EXPECT_EQ(hm.size(), expected.size());
+  EXPECT_GT(hm.get_capacity(), static_cast<size_t>(10));
+
+  StringHashMap<int> copy(hm);
+  StringHashMap<int> assigned;
+  assigned.insert("stale", 1);
+  assigned = copy;
+  hm.clear();
+  EXPECT_TRUE(hm.empty());
+
+  size_t visited = 0;
+  string key;
+  int value;
+  assigned.begin();
+  while (assigned.next(key, value)) {
+    EXPECT_EQ(expected.at(key), value);
+    EXPECT_EQ(copy.at(key), value);
+    visited++;
+  }
+  EXPECT_EQ(visited, expected.size());
+  EXPECT_FALSE(assigned.contains("stale"));
+
+  size_t counted = 0;
+  copy.for_each([&](string_view k, int& v) {
+    EXPECT_EQ(expected.at(string(k)), v);
+    counted++;
+  });
+  EXPECT_EQ(counted, expected.size());
+}
+
+TEST(HashMapString, FailedAssignmentLeavesTargetUnchanged) {
+  StringHashMap<FragileValue> source;
+  for (int i = 0; i < 100; ++i) {
+    source.insert("key" + to_string(i), i);
+  }
+  StringHashMap<FragileValue> target;
+  target.insert("kept", 7);
+
+  FragileValue::copiesLeft = 50;
+  EXPECT_THROW(target = source, runtime_error);
+  FragileValue::copiesLeft = LONG_MAX;
+  EXPECT_EQ(target.size(), static_cast<size_t>(1));
+  EXPECT_EQ(target.at("kept").v, 7);
+
+  target = source;
+  EXPECT_EQ(target.size(), static_cast<size_t>(100));
+  EXPECT_FALSE(target.contains("kept"));
+}
+
+TEST(HashMapString, OverAlignedValues) {
+  struct alignas(64) Wide {
+    int v;
+  };
+  StringHashMap<Wide> hm;
+  for (int i = 0; i < 200; ++i) {
+    hm.insert(string(i % 7, 'k') + to_string(i), Wide{i});
+  }
+  for (int i = 0; i < 200; ++i) {
+    const Wide& w = hm.at(string(i % 7, 'k') + to_string(i));
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(&w) % 64, 0u);
+    EXPECT_EQ(w.v, i);
+  }
+}
+
+TEST(HashMapClone, CopiesIntoOneBlockAndStaysIndependent) {
+  HashMap<int, int> trivial;
+  HashMap<string, string> strings;
+  trivial.set_filter(true);
+  for (int i = 0; i < 2000; ++i) {
+    trivial.insert(i, i * 3);
+    strings.insert("key" + to_string(i), string(i % 50, 'v'));
+  }
+
+  HashMap<int, int> trivialCopy(trivial);
+  HashMap<string, string> stringsCopy(strings);
+  EXPECT_TRUE(trivialCopy == trivial);
+  EXPECT_TRUE(stringsCopy == strings);
+  EXPECT_TRUE(trivialCopy.filter_enabled());
+  EXPECT_FALSE(trivialCopy.contains(5000));
+
+  // Erasing and re-inserting in the copy mixes block and heap nodes
+  for (int i = 0; i < 2000; i += 3) {
+    EXPECT_EQ(trivialCopy.erase(i), i * 3);
+    stringsCopy.erase("key" + to_string(i));
+  }
+  trivialCopy.insert(0, -1);
+  stringsCopy.insert("key0", "new");
+  EXPECT_EQ(trivial.at(0), 0);
+  EXPECT_EQ(strings.at("key3"), string(3, 'v'));
+  EXPECT_EQ(trivialCopy.at(0), -1);
+  EXPECT_EQ(stringsCopy.at("key0"), "new");
+  EXPECT_FALSE(stringsCopy.contains("key3"));
+}
+
+TEST(HashMapClone, AssignmentReusesNodesAndBuckets) {
+  HashMap<string, int> big;
+  HashMap<string, int> small;
+  for (int i = 0; i < 1000; ++i) {
+    big.insert("b" + to_string(i), i);
+  }
+  for (int i = 0; i < 10; ++i) {
+    small.insert("s" + to_string(i), i);
+  }
+
+  HashMap<string, int> target(small);
+  target = big;  // grows: reuses 10 nodes, allocates the rest in a block
+  EXPECT_TRUE(target == big);
+  EXPECT_EQ(target.get_capacity(), big.get_capacity());
+
+  target = small;  // shrinks: rebuilds 10 nodes, destroys the rest
+  EXPECT_TRUE(target == small);
+  EXPECT_EQ(target.get_capacity(), small.get_capacity());
+
+  HashMap<string, int> sameSize(big);
+  sameSize.erase("b1");
+  sameSize.insert("extra", -1);
+  sameSize.set_filter(true);
+  sameSize = big;  // same capacity: buckets reused, filter dropped
+  EXPECT_TRUE(sameSize == big);
+  EXPECT_FALSE(sameSize.filter_enabled());
+
+  big.set_filter(true);
+  sameSize = big;
+  EXPECT_TRUE(sameSize.filter_enabled());
+  EXPECT_FALSE(sameSize.contains("b1000"));
+  EXPECT_EQ(sameSize.at("b999"), 999);
+
+  HashMap<string, int> empty(0);
+  sameSize = empty;
+  EXPECT_TRUE(sameSize.empty());
+  sameSize.insert("again", 1);
+  EXPECT_EQ(sameSize.at("again"), 1);
+}
+
+TEST(HashMapClone, BlockNodesOutliveTheCopyWhenMoved) {
+  HashMap<int, string> kept;
+  HashMap<int, string>::node_type handle;
+  HashMap<int, string> merged;
+  {
+    HashMap<int, string> source;
+    for (int i = 0; i < 100; ++i) {
+      source.insert(i, "value" + to_string(i));
+    }
+    HashMap<int, string> copy(source);
+    handle = copy.extract(1);
+    EXPECT_TRUE(kept.insert(copy.extract(2)));
+    kept.splice(copy);  // moves the other 98 block nodes
+
+    HashMap<int, string> copy2(source);
+    copy2.erase(5);
+    merged.insert(6, "mine");
+    merged.merge(copy2, [](const string& mine, const string& theirs) {
+      return mine + "+" + theirs;
+    });
+  }
+
+  EXPECT_EQ(handle.key(), 1);
+  EXPECT_EQ(handle.mapped(), "value1");
+  EXPECT_EQ(kept.size(), static_cast<size_t>(99));
+  EXPECT_EQ(kept.at(2), "value2");
+  EXPECT_EQ(kept.at(99), "value99");
+  EXPECT_EQ(merged.size(), static_cast<size_t>(99));
+  EXPECT_EQ(merged.at(6), "mine+value6");
+  EXPECT_FALSE(merged.contains(5));
+
+  HashMap<int, string> copyOfKept(kept);
+  kept.clear();
+  EXPECT_EQ(copyOfKept.at(50), "value50");
+  EXPECT_TRUE(kept.insert(std::move(handle)));
+  EXPECT_EQ(kept.at(1), "value1");
+}
+
+TEST(HashMapClone, EmptiedSlabsAreReleased) {
+  HashMap<int, int> big;
+  HashMap<int, int> small;
+  for (int i = 0; i < 20000; ++i) {
+    big.insert(i, i);
+  }
+  for (int i = 0; i < 10; ++i) {
+    small.insert(i, -i);
+  }
+
+  // Each big assignment carves a new slab; shrinking back must free it
+  HashMap<int, int> target;
+  for (int round = 0; round < 40; ++round) {
+    target = big;
+    target = small;
+    EXPECT_LE(target.get_slab_count(), small.size());
+  }
+  EXPECT_TRUE(target == small);
+
+  HashMap<int, int> copy(big);
+  EXPECT_EQ(copy.get_slab_count(), static_cast<size_t>(1));
+  for (int i = 0; i < 10000; ++i) {
+    copy.erase(i);
+  }
+  copy.erase_if([](const int& key, const int&) { return key % 2 == 0; });
+  EXPECT_EQ(copy.get_slab_count(), static_cast<size_t>(1));
+  copy.erase_if([](const int&, const int&) { return true; });
+  EXPECT_EQ(copy.get_slab_count(), static_cast<size_t>(0));
+
+  // Nodes merged away keep their slab alive only in the map holding them
+  HashMap<int, int> source(big);
+  HashMap<int, int> sink;
+  sink.merge(source, [](int mine, int) { return mine; });
+  EXPECT_EQ(sink.get_slab_count(), static_cast<size_t>(1));
+  for (int i = 0; i < 20000; ++i) {
+    sink.erase(i);
+  }
+  EXPECT_EQ(sink.get_slab_count(), static_cast<size_t>(0));
+}
+
+TEST(HashSet, InsertContainsEraseWithoutValues) {
+  HashSet<uint64_t> set;
+  EXPECT_TRUE(set.insert(7));
+  EXPECT_FALSE(set.insert(7));
+  for (uint64_t i = 0; i < 1000; ++i) {
+    set.insert(i * 3);
+  }
+  EXPECT_EQ(set.size(), static_cast<size_t>(1001));
+  EXPECT_TRUE(set.contains(7));
+  EXPECT_TRUE(set.contains(2997));
+  EXPECT_FALSE(set.contains(2998));
+
+  set.erase(7);
+  EXPECT_FALSE(set.contains(7));
+  EXPECT_THROW(set.erase(7), out_of_range);
+  EXPECT_EQ(set.erase_if([](const uint64_t& key) { return key % 2 == 0; }),
+            static_cast<size_t>(500));
+
+  size_t visited = 0;
+  uint64_t key;
+  set.begin();
+  while (set.next(key)) {
+    EXPECT_EQ(key % 6, static_cast<uint64_t>(3));
+    visited++;
+  }
+  EXPECT_EQ(visited, set.size());
+}
+
+TEST(HashSet, OnlyEmptyValuesShareSpace) {
+  struct Empty {};
+  // Not POD for layout, so its tail padding could be reused
+  struct alignas(16) Padded {
+    uint64_t v;
+    Padded(uint64_t v) : v(v) {
+    }
+  };
+  struct PlainNode {
+    const uint64_t key;
+    Padded value;
+    void* next;
+  };
+  EXPECT_EQ(sizeof(HashMapNode<uint64_t, Empty>), 2 * sizeof(uint64_t));
+  EXPECT_EQ(sizeof(HashMapNode<uint64_t, Padded>), sizeof(PlainNode));
+}
+
+TEST(HashSet, SetAlgebraMatchesMembership) {
+  // Same capacity (paired buckets) and different capacity (lookups)
+  for (size_t otherCapacity : {size_t(10), size_t(7)}) {
+    HashSet<int> a;
+    HashSet<int> b(otherCapacity);
+    for (int i = 0; i < 600; ++i) {
+      a.insert(i);        // 0..599
+      b.insert(i + 400);  // 400..999
+    }
+
+    HashSet<int> both = a.intersect(b);
+    HashSet<int> either = a.unite(b);
+    HashSet<int> onlyA = a.difference(b);
+    EXPECT_EQ(both.size(), static_cast<size_t>(200));
+    EXPECT_EQ(either.size(), static_cast<size_t>(1000));
+    EXPECT_EQ(onlyA.size(), static_cast<size_t>(400));
+    for (int i = 0; i < 1000; ++i) {
+      EXPECT_EQ(both.contains(i), i >= 400 && i < 600);
+      EXPECT_TRUE(either.contains(i));
+      EXPECT_EQ(onlyA.contains(i), i < 400);
+    }
+    EXPECT_TRUE(b.unite(a) == either);
+    EXPECT_TRUE(a.difference(a).empty());
+    EXPECT_TRUE(a.intersect(HashSet<int>()).empty());
+
+    both.insert(5000);
+    EXPECT_TRUE(both.contains(5000));
+  }
+}
+
+TEST(HashMapCompact, ReserveAvoidsSlack) {
+  const size_t n = 100000;
+  CompactHashMap<uint32_t, uint32_t> compact;
+  compact.reserve(n);
+  size_t capacity = compact.get_capacity();
+  for (uint32_t i = 0; i < n; ++i) {
+    compact.insert(i, i + 1);
+  }
+  EXPECT_EQ(compact.get_capacity(), capacity);
+  EXPECT_EQ(compact.at(n - 1), n);
+
+  // 12-byte entries plus 4-byte heads; a HashMap node alone is 16 bytes
+  // before its allocator header and bucket slot.
+  EXPECT_LE(compact.memory_bytes(), n * 12 + capacity * 4);
+  EXPECT_LT(compact.memory_bytes(), n * 16);
+}
+
+TieredOptions smallTiered(const string& dir) {
+  TieredOptions options;
+  options.path = dir + "/spill";
+  options.memory_budget = 16 << 10;
+  options.pages = 16;
+  options.read_ahead_bytes = 4 << 10;
+  return options;
+}
+
+TEST(HashMapTiered, SpillsAndFaultsUnderSmallBudget) {
+  string dir = makeTempDir();
+  {
+    TieredHashMap<int, string> tiered(smallTiered(dir));
+    for (int k = 0; k < 2000; ++k) {
+      tiered.insert(k, "value-" + to_string(k * 3));
+    }
+    for (int k = 0; k < 2000; ++k) {
+      ASSERT_EQ(tiered.at(k), "value-" + to_string(k * 3)) << k;
+    }
+
+    TieredStats s = tiered.stats();
+    EXPECT_GT(s.cold_pages, 0u);
+    EXPECT_GT(s.evictions, 0u);
+    EXPECT_GT(s.faults, 0u);
+    EXPECT_GT(s.read_ahead, 0u);
+    EXPECT_GT(s.file_bytes, 0u);
+    EXPECT_LE(s.resident_bytes, size_t(16 << 10) + size_t(8 << 10));
+    EXPECT_EQ(s.resident_pages + s.cold_pages, size_t(16));
+    EXPECT_EQ(fileSize(dir + "/spill"), static_cast<long>(s.file_bytes));
+  }
+  EXPECT_EQ(fileSize(dir + "/spill"), -1);
+  rmdir(dir.c_str());
+}
+
+TEST(HashMapTiered, UnchangedPagesAreNotRewritten) {
+  string dir = makeTempDir();
+  {
+    TieredHashMap<int, int> tiered(smallTiered(dir));
+    for (int i = 0; i < 2000; ++i) {
+      tiered.insert(i, i);
+    }
+    // Only pages still resident can hold unwritten changes; reads add none.
+    TieredStats before = tiered.stats();
+    long sum = 0;
+    for (int round = 0; round < 3; ++round) {
+      for (int i = 0; i < 2000; ++i) {
+        sum += tiered.at(i);
+      }
+    }
+    EXPECT_EQ(sum, 3L * 1999 * 2000 / 2);
+    EXPECT_LE(tiered.stats().bytes_written - before.bytes_written,
+              before.resident_bytes);
+    EXPECT_GT(tiered.stats().bytes_read, 0u);
+
+    tiered.clear();
+    EXPECT_TRUE(tiered.empty());
+    EXPECT_FALSE(tiered.contains(5));
+    EXPECT_EQ(tiered.stats().file_bytes, 0u);
+    tiered.insert(5, 50);
+    EXPECT_EQ(tiered.at(5), 50);
+  }
+  rmdir(dir.c_str());
+}
+
+TEST(HashMapTiered, ClockKeepsTheHotPageResident) {
+  string dir = makeTempDir();
+  {
+    // About a quarter of the pages fit once every key is in
+    TieredOptions options = smallTiered(dir);
+    options.memory_budget = 24 << 10;
+    options.read_ahead_bytes = 0;
+    TieredHashMap<int, int> tiered(options);
+    tiered.insert(-1, 7);
+    size_t hotFaults = 0;
+    for (int i = 0; i < 2000; ++i) {
+      tiered.insert(i, i);
+      uint64_t before = tiered.stats().faults;
+      ASSERT_EQ(tiered.at(-1), 7);
+      hotFaults += tiered.stats().faults - before;
+    }
+    // Pages used once go first: the page read after every insert keeps
+    // getting a second chance while the others are evicted around it.
+    TieredStats s = tiered.stats();
+    EXPECT_GT(s.evictions, 1000u);
+    EXPECT_LT(hotFaults * 20, s.evictions) << hotFaults;
+  }
+  rmdir(dir.c_str());
+}
+
+TEST(HashMapTiered, BudgetCountsNodesAndValues) {
+  string dir = makeTempDir();
+  {
+    TieredOptions options = smallTiered(dir);
+    options.memory_budget = 1;
+    TieredHashMap<int, string> tiered(options);
+    string big(4 << 10, 'x');
+    for (int k = 0; k < 64; ++k) {
+      tiered.insert(k, big);
+      // A page over the budget on its own stays, but only while it is used
+      ASSERT_EQ(tiered.stats().resident_pages, 1u);
+      ASSERT_GE(tiered.stats().resident_bytes,
+                tiered.stats().resident_pages * big.size());
+    }
+    for (int k = 0; k < 64; ++k) {
+      ASSERT_EQ(tiered.at(k), big) << k;
+    }
+    EXPECT_EQ(tiered.stats().resident_pages, 1u);
+  }
+  rmdir(dir.c_str());
+}
+
+TEST(HashMapTiered, RequiresSpillPath) {
+  EXPECT_THROW((TieredHashMap<int, int>(TieredOptions())), invalid_argument);
+}
+
+// Removes an empty temporary directory when it goes out of scope.
+struct TempDir {
+  string path = makeTempDir();
+
+  ~TempDir() {
+    rmdir(path.c_str());
+  }
+};
+
+// The maps below share HashMap's insert/at/contains/erase contract. Each
+// variant builds one and maps an int to its key type.
+struct FilteredVariant {
+  using Key = int;
+  HashMap<int, int> map{1};
+
+  FilteredVariant() {
+    map.set_filter(true);
+  }
+
+  static Key key(int k) {
+    return k;
+  }
+};
+
+struct ColumnarVariant {
+  using Key = int;
+  ColumnarHashMap<int, int> map{1};
+
+  static Key key(int k) {
+    return k;
+  }
+};
+
+struct CompactVariant {
+  using Key = uint32_t;
+  CompactHashMap<uint32_t, int> map{1};
+
+  static Key key(int k) {
+    return static_cast<uint32_t>(k);
+  }
+};
+
+struct StringVariant {
+  using Key = string;
+  StringHashMap<int> map{1};
+
+  static Key key(int k) {
+    return "/path/" + to_string(k) + string(k % 40, 'q');
+  }
+};
+
+struct TieredVariant {
+  using Key = int;
+  TempDir dir;  // declared first, so it is removed after the spill file
+  TieredHashMap<int, int> map{options(dir.path)};
+
+  static TieredOptions options(const string& dir) {
+    TieredOptions o;
+    o.path = dir + "/spill";
+    o.memory_budget = 2 << 10;  // a few of the 16 pages
+    o.pages = 16;
+    o.read_ahead_bytes = 1 << 10;
+    return o;
+  }
+
+  static Key key(int k) {
+    return k;
+  }
+};
+
+template <typename Variant>
+class HashMapVariants : public Test {};
+
+using VariantTypes = Types<FilteredVariant, ColumnarVariant, CompactVariant,
+                           StringVariant, TieredVariant>;
+TYPED_TEST_SUITE(HashMapVariants, VariantTypes);
+
+TYPED_TEST(HashMapVariants, MatchesHashMapUnderRandomOperations) {
+  TypeParam variant;
+  auto& map = variant.map;
+  HashMap<typename TypeParam::Key, int> reference(1);
+  Random::seed(33);
+
+  for (int i = 0; i < 4000; ++i) {
+    typename TypeParam::Key k = TypeParam::key(Random::randInt(300));
+    if (Random::randInt(2) == 0) {
+      if (reference.contains(k)) {
+        ASSERT_EQ(map.erase(k), reference.erase(k));
+      } else {
+        EXPECT_THROW(map.erase(k), out_of_range);
+      }
+    } else {
+      map.insert(k, i);  // never overwrites
+      reference.insert(k, i);
+    }
+  }
+
+  ASSERT_EQ(map.size(), reference.size());
+  for (int i = 0; i <= 350; ++i) {
+    typename TypeParam::Key k = TypeParam::key(i);
+    ASSERT_EQ(map.contains(k), reference.contains(k)) << i;
+    if (reference.contains(k)) {
+      EXPECT_EQ(map.at(k), reference.at(k));
+    } else {
+      EXPECT_THROW(map.at(k), out_of_range);
+    }
+  }
+
+  map.clear();
+  EXPECT_TRUE(map.empty());
+  EXPECT_FALSE(map.contains(TypeParam::key(1)));
+  map.insert(TypeParam::key(1), 7);
+  EXPECT_EQ(map.at(TypeParam::key(1)), 7);
+}
+
 }  // namespace
@@ -0,0 +1,437 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+/**
+ * A chained hash map whose `snapshot()` is O(1).
+ *
+ * The bucket array is stored as a radix tree of 64-bucket pages, and every
+ * page, tree level and chain node is reference counted. A snapshot shares
+ * the whole structure; a later write to the live map copies only the tree
+ * path down to the bucket it changes (about 1 KB per level) and the chain
+ * nodes in front of the one it removes. Copying a `SnapshotHashMap` is O(1)
+ * for the same reason.
+ *
+ * Tree levels are stamped with the generation of the map that created them,
+ * and `snapshot()` and copying start a new generation. A write updates a
+ * level in place only if it is from the current generation, i.e. created
+ * since anything else could see it, so the writer never touches memory a
+ * snapshot may be reading, whatever thread reads it.
+ *
+ * Snapshots are read-only and lock-free. Reading a snapshot on another
+ * thread never blocks the live map's writer, but a single
+ * `SnapshotHashMap` still needs external synchronization between writers,
+ * and `snapshot()` counts as a write.
+ *
+ * Unlike `HashMap`, values are read-only, since they may be shared with
+ * snapshots, and a resize builds new chain nodes rather than relinking them.
+ */
+template <typename KeyT, typename ValT>
+class SnapshotHashMap {
+ private:
+  struct ChainNode {
+    const KeyT key;
+    const ValT value;
+    shared_ptr<const ChainNode> next;
+
+    ChainNode(const KeyT& key, const ValT& value,
+              shared_ptr<const ChainNode> next)
+        : key(key), value(value), next(std::move(next)) {
+    }
+
+    ~ChainNode() {
+      // Frees a long chain from a loop rather than recursing once per node:
+      // a successor freed by the loop hands its own successor back to it.
+      // Only the node being destroyed is modified, never a shared one.
+      static thread_local shared_ptr<const ChainNode>* pending = nullptr;
+      if (pending != nullptr) {
+        *pending = std::move(next);
+        return;
+      }
+
+      shared_ptr<const ChainNode> rest = std::move(next);
+      pending = &rest;
+      while (rest) {
+        shared_ptr<const ChainNode> node = std::move(rest);
+        node.reset();  // may refill `rest`
+      }
+      pending = nullptr;
+    }
+  };
+
+  using NodePtr = shared_ptr<const ChainNode>;
+
+  static constexpr int kPageBits = 6;
+  static constexpr size_t kFanout = size_t(1) << kPageBits;
+  static constexpr size_t kMask = kFanout - 1;
+
+  // Level 0 of the tree holds bucket heads; higher levels hold children.
+  // Levels are stored type-erased and cast by depth. A null level means
+  // every bucket below it is empty.
+  struct Page {
+    uint64_t generation = 0;
+    NodePtr heads[kFanout];
+  };
+
+  struct Branch {
+    uint64_t generation = 0;
+    shared_ptr<void> children[kFanout];
+  };
+
+  // One version of the table; copying it shares everything.
+  struct Table {
+    shared_ptr<void> root;
+    int depth;
+    size_t capacity;
+    size_t sz;
+  };
+
+  Table table;
+
+  // Levels stamped with this generation are reachable only from `table`.
+  // Changed by `snapshot()` and copies, which share every existing level.
+  mutable uint64_t generation;
+
+  // Helper functions
+
+  // Returns a generation no map has used yet.
+  static uint64_t newGeneration() {
+    static atomic<uint64_t> last{0};
+    return last.fetch_add(1, memory_order_relaxed) + 1;
+  }
+
+  static Table emptyTable(size_t capacity) {
+    if (capacity == 0) {
+      capacity = 1;
+    }
+    int depth = 0;
+    for (size_t pages = (capacity + kMask) >> kPageBits; pages > 1;
+         pages = (pages + kMask) >> kPageBits) {
+      depth++;
+    }
+    return Table{nullptr, depth, capacity, 0};
+  }
+
+  static size_t bucketIndex(const Table& t, const KeyT& key) {
+    return std::hash<KeyT>()(key) % t.capacity;
+  }
+
+  static const NodePtr* headSlot(const Table& t, size_t idx) {
+    const void* level = t.root.get();
+    for (int d = t.depth; d > 0 && level != nullptr; d--) {
+      const Branch* branch = static_cast<const Branch*>(level);
+      level = branch->children[(idx >> (kPageBits * d)) & kMask].get();
+    }
+    if (level == nullptr) {
+      return nullptr;
+    }
+    return &static_cast<const Page*>(level)->heads[idx & kMask];
+  }
+
+  static const ChainNode* findNode(const Table& t, const KeyT& key) {
+    const NodePtr* head = headSlot(t, bucketIndex(t, key));
+    const ChainNode* node = head != nullptr ? head->get() : nullptr;
+    while (node != nullptr && !(node->key == key)) {
+      node = node->next.get();
+    }
+    return node;
+  }
+
+  // Returns `level` of type `Level` owned by generation `gen`: `level`
+  // itself if it is, otherwise a copy (or a new empty level).
+  template <typename Level>
+  static shared_ptr<Level> owned(const shared_ptr<void>& level, uint64_t gen) {
+    shared_ptr<Level> result;
+    if (level == nullptr) {
+      result = make_shared<Level>();
+    } else if (static_cast<const Level*>(level.get())->generation != gen) {
+      result = make_shared<Level>(*static_cast<const Level*>(level.get()));
+    } else {
+      return static_pointer_cast<Level>(level);
+    }
+    result->generation = gen;
+    return result;
+  }
+
+  // Returns `level` (at `depth`) with bucket `idx` set to `head`, copying
+  // the levels on the path that generation `gen` does not own.
+  static shared_ptr<void> withHead(const shared_ptr<void>& level, int depth,
+                                   size_t idx, NodePtr head, uint64_t gen) {
+    if (depth == 0) {
+      shared_ptr<Page> page = owned<Page>(level, gen);
+      page->heads[idx & kMask] = std::move(head);
+      return page;
+    }
+
+    shared_ptr<Branch> branch = owned<Branch>(level, gen);
+    shared_ptr<void>& child =
+        branch->children[(idx >> (kPageBits * depth)) & kMask];
+    child = withHead(child, depth - 1, idx, std::move(head), gen);
+    return branch;
+  }
+
+  void setHead(Table& t, size_t idx, NodePtr head) {
+    t.root = withHead(t.root, t.depth, idx, std::move(head), generation);
+  }
+
+  static NodePtr headOf(const Table& t, size_t idx) {
+    const NodePtr* head = headSlot(t, idx);
+    return head != nullptr ? *head : nullptr;
+  }
+
+  template <typename Fn>
+  static void forEachIn(const void* level, int depth, Fn& fn) {
+    if (level == nullptr) {
+      return;
+    }
+    if (depth == 0) {
+      for (const NodePtr& head : static_cast<const Page*>(level)->heads) {
+        for (const ChainNode* n = head.get(); n != nullptr; n = n->next.get()) {
+          fn(n->key, n->value);
+        }
+      }
+      return;
+    }
+    for (const shared_ptr<void>& child :
+         static_cast<const Branch*>(level)->children) {
+      forEachIn(child.get(), depth - 1, fn);
+    }
+  }
+
+  void rehash(size_t newCapacity) {
+    Table newTable = emptyTable(newCapacity);
+    auto relink = [&](const KeyT& key, const ValT& value) {
+      size_t idx = bucketIndex(newTable, key);
+      setHead(newTable, idx,
+              make_shared<const ChainNode>(key, value, headOf(newTable, idx)));
+    };
+    forEachIn(table.root.get(), table.depth, relink);
+    newTable.sz = table.sz;
+    table = std::move(newTable);
+  }
+
+ public:
+  /**
+   * Read-only, point-in-time view of a `SnapshotHashMap`. Unaffected by
+   * later writes to the map; safe to read from any thread.
+   */
+  class Snapshot {
+   private:
+    Table table;
+
+    explicit Snapshot(const Table& table) : table(table) {
+    }
+
+    friend class SnapshotHashMap;
+
+   public:
+    size_t size() const {
+      return table.sz;
+    }
+
+    bool empty() const {
+      return table.sz == 0;
+    }
+
+    /**
+     * Returns `true` if the key was present when the snapshot was taken.
+     */
+    bool contains(const KeyT& key) const {
+      return findNode(table, key) != nullptr;
+    }
+
+    /**
+     * Returns the value stored for `key` when the snapshot was taken. Throws
+     * `out_of_range` if it was not present.
+     */
+    const ValT& at(const KeyT& key) const {
+      const ChainNode* node = findNode(table, key);
+      if (node == nullptr) {
+        throw out_of_range("Key not found");
+      }
+      return node->value;
+    }
+
+    /**
+     * Calls `fn(key, value)` for every mapping in the snapshot.
+     */
+    template <typename Fn>
+    void for_each(Fn fn) const {
+      forEachIn(table.root.get(), table.depth, fn);
+    }
+  };
+
+  /**
+   * Creates an empty `SnapshotHashMap` with 10 buckets.
+   */
+  SnapshotHashMap() : SnapshotHashMap(10) {
+  }
+
+  /**
+   * Creates an empty `SnapshotHashMap` with `capacity` buckets.
+   */
+  explicit SnapshotHashMap(size_t capacity)
+      : table(emptyTable(capacity)), generation(newGeneration()) {
+  }
+
+  /**
+   * Copy constructor. Runs in O(1): both maps share the contents, and each
+   * copies what it later modifies.
+   */
+  SnapshotHashMap(const SnapshotHashMap& other)
+      : table(other.table), generation(newGeneration()) {
+    other.generation = newGeneration();
+  }
+
+  /**
+   * Assignment operator. Runs in O(1), sharing as the copy constructor does.
+   */
+  SnapshotHashMap& operator=(const SnapshotHashMap& other) {
+    if (this != &other) {
+      table = other.table;
+      generation = newGeneration();
+      other.generation = newGeneration();
+    }
+    return *this;
+  }
+
+  /**
+   * Returns a read-only view of the current contents. Runs in O(1) and
+   * allocates nothing; later writes copy only what they modify.
+   */
+  Snapshot snapshot() const {
+    generation = newGeneration();
+    return Snapshot(table);
+  }
+
+  bool empty() const {
+    return table.sz == 0;
+  }
+
+  size_t size() const {
+    return table.sz;
+  }
+
+  size_t get_capacity() const {
+    return table.capacity;
+  }
+
+  /**
+   * Adds the mapping `{key -> value}`. If the key already exists, does not
+   * update the mapping. The new node goes at the head of its chain, so no
+   * existing node is copied.
+   *
+   * Runs in O(L + D), where D is the depth of the bucket tree, plus O(D)
+   * page copies for the levels created before the last snapshot or copy.
+   */
+  void insert(const KeyT& key, const ValT& value) {
+    if (2 * (table.sz + 1) > 3 * table.capacity) {  // load factor > 1.5
+      rehash(table.capacity * 2);
+    }
+
+    size_t idx = bucketIndex(table, key);
+    NodePtr head = headOf(table, idx);
+    for (const ChainNode* n = head.get(); n != nullptr; n = n->next.get()) {
+      if (n->key == key) {
+        return;
+      }
+    }
+
+    setHead(table, idx,
+            make_shared<const ChainNode>(key, value, std::move(head)));
+    table.sz++;
+  }
+
+  /**
+   * Returns `true` if the key is present.
+   *
+   * Runs in O(L + D).
+   */
+  bool contains(const KeyT& key) const {
+    return findNode(table, key) != nullptr;
+  }
+
+  /**
+   * Returns the value stored for `key`. Values are read-only because they
+   * may be shared with snapshots.
+   *
+   * If key is not present in the map, throw `out_of_range` exception.
+   *
+   * Runs in O(L + D).
+   */
+  const ValT& at(const KeyT& key) const {
+    const ChainNode* node = findNode(table, key);
+    if (node == nullptr) {
+      throw out_of_range("Key not found");
+    }
+    return node->value;
+  }
+
+  /**
+   * Removes the mapping for `key` and returns its value. The nodes in front
+   * of it in the chain are copied (path copying); the rest of the chain is
+   * shared with the old version.
+   *
+   * Throws `out_of_range` if the key is not present in the map.
+   *
+   * Runs in O(L + D).
+   */
+  ValT erase(const KeyT& key) {
+    size_t idx = bucketIndex(table, key);
+    NodePtr head = headOf(table, idx);
+
+    const ChainNode* target = head.get();
+    size_t prefix = 0;
+    while (target != nullptr && !(target->key == key)) {
+      target = target->next.get();
+      prefix++;
+    }
+    if (target == nullptr) {
+      throw out_of_range("Key not found");
+    }
+
+    ValT removedValue = target->value;
+
+    // Rebuild the prefix back to front on top of the shared suffix.
+    vector<const ChainNode*> front;
+    front.reserve(prefix);
+    for (const ChainNode* n = head.get(); n != target; n = n->next.get()) {
+      front.push_back(n);
+    }
+    NodePtr rebuilt = target->next;
+    for (size_t i = front.size(); i-- > 0;) {
+      rebuilt = make_shared<const ChainNode>(front[i]->key, front[i]->value,
+                                             std::move(rebuilt));
+    }
+
+    head.reset();
+    setHead(table, idx, std::move(rebuilt));
+    table.sz--;
+    return removedValue;
+  }
+
+  /**
+   * Removes all mappings, keeping the bucket count. Snapshots keep their
+   * contents.
+   *
+   * Runs in O(1) if a snapshot shares the contents, and O(N+B) otherwise.
+   */
+  void clear() {
+    table = emptyTable(table.capacity);
+  }
+
+  /**
+   * Calls `fn(key, value)` for every mapping.
+   */
+  template <typename Fn>
+  void for_each(Fn fn) const {
+    forEachIn(table.root.get(), table.depth, fn);
+  }
+};
@@ -0,0 +1,369 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+
+using namespace std;
+
+/**
+ * A chained hash map from strings to `ValT` with variable-length nodes.
+ *
+ * Each node stores the key bytes directly after its fixed fields, together
+ * with the key's length and cached hash, so a mapping costs exactly one
+ * allocation however long the key is. A lookup compares the cached hash and
+ * length first and then the key bytes, which sit in the same allocation as
+ * the link being followed. A resize relinks nodes using the cached hashes
+ * without hashing any key again.
+ *
+ * Lookups take a `string_view`, so probing with a literal or a slice of a
+ * larger buffer builds no `std::string`.
+ *
+ * Keys are limited to 2^32 - 1 bytes; `insert` throws `length_error` for a
+ * longer one.
+ */
+template <typename ValT>
+class StringHashMap {
+ private:
+  struct ChainNode {
+    ChainNode* next;
+    size_t hash;
+    uint32_t len;
+    ValT value;
+
+    ChainNode(ChainNode* next, size_t hash, uint32_t len, const ValT& value)
+        : next(next), hash(hash), len(len), value(value) {
+    }
+
+    // The key bytes follow the node in the same allocation.
+    char* keyData() {
+      return reinterpret_cast<char*>(this + 1);
+    }
+
+    string_view key() const {
+      return string_view(reinterpret_cast<const char*>(this + 1), len);
+    }
+  };
+
+  ChainNode** data;
+  size_t sz;
+  size_t capacity;
+
+  // Utility members for begin/next
+  ChainNode* curr;
+  size_t curr_idx;
+
+  // Helper functions
+
+  static size_t hashOf(string_view key) {
+    return std::hash<string_view>()(key);
+  }
+
+  // Node storage honors `alignof(ValT)`, which may exceed what plain
+  // `operator new` guarantees.
+  static void* allocateNode(size_t bytes) {
+    if constexpr (alignof(ChainNode) > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+      return ::operator new(bytes, align_val_t(alignof(ChainNode)));
+    } else {
+      return ::operator new(bytes);
+    }
+  }
+
+  static void deallocateNode(void* mem) {
+    if constexpr (alignof(ChainNode) > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+      ::operator delete(mem, align_val_t(alignof(ChainNode)));
+    } else {
+      ::operator delete(mem);
+    }
+  }
+
+  static ChainNode* makeNode(string_view key, size_t hash, const ValT& value,
+                             ChainNode* next) {
+    if (key.size() > UINT32_MAX) {
+      throw length_error("StringHashMap key too long");
+    }
+    void* mem = allocateNode(sizeof(ChainNode) + key.size());
+    ChainNode* node;
+    try {
+      node = new (mem)
+          ChainNode(next, hash, static_cast<uint32_t>(key.size()), value);
+    } catch (...) {
+      deallocateNode(mem);
+      throw;
+    }
+    if (!key.empty()) {
+      memcpy(node->keyData(), key.data(), key.size());
+    }
+    return node;
+  }
+
+  static void destroyNode(ChainNode* node) {
+    node->~ChainNode();
+    deallocateNode(node);
+  }
+
+  void initBuckets(size_t cap) {
+    cap = cap == 0 ? 1 : cap;
+    data = new ChainNode*[cap]();
+    capacity = cap;
+  }
+
+  void freeNodes() {
+    for (size_t i = 0; i < capacity; i++) {
+      ChainNode* node = data[i];
+      while (node != nullptr) {
+        ChainNode* nextNode = node->next;
+        destroyNode(node);
+        node = nextNode;
+      }
+      data[i] = nullptr;
+    }
+    sz = 0;
+  }
+
+  // Copies the chains of `other` into freshly initialized buckets of the
+  // same capacity, preserving chain order.
+  void copyNodes(const StringHashMap& other) {
+    initBuckets(other.capacity);
+    for (size_t i = 0; i < other.capacity; i++) {
+      ChainNode** tailPtr = &data[i];
+      for (ChainNode* n = other.data[i]; n != nullptr; n = n->next) {
+        *tailPtr = makeNode(n->key(), n->hash, n->value, nullptr);
+        tailPtr = &(*tailPtr)->next;
+        sz++;
+      }
+    }
+  }
+
+  // Relinks every node into `newCapacity` buckets using the cached hashes.
+  void rehash(size_t newCapacity) {
+    ChainNode** newData = new ChainNode*[newCapacity]();
+    for (size_t i = 0; i < capacity; i++) {
+      ChainNode* node = data[i];
+      while (node != nullptr) {
+        ChainNode* nextNode = node->next;
+        size_t idx = node->hash % newCapacity;
+        node->next = newData[idx];
+        newData[idx] = node;
+        node = nextNode;
+      }
+    }
+    delete[] data;
+    data = newData;
+    capacity = newCapacity;
+  }
+
+  ChainNode* findNode(string_view key, size_t hash) const {
+    ChainNode* node = data[hash % capacity];
+    // string_view's == checks the length before comparing bytes
+    while (node != nullptr && !(node->hash == hash && node->key() == key)) {
+      node = node->next;
+    }
+    return node;
+  }
+
+ public:
+  /**
+   * Creates an empty `StringHashMap` with 10 buckets.
+   */
+  StringHashMap() : StringHashMap(10) {
+  }
+
+  /**
+   * Creates an empty `StringHashMap` with `capacity` buckets.
+   */
+  explicit StringHashMap(size_t capacity)
+      : sz(0), curr(nullptr), curr_idx(0) {
+    initBuckets(capacity);
+  }
+
+  /**
+   * Copy constructor. Runs in O(N+B).
+   */
+  StringHashMap(const StringHashMap& other)
+      : data(nullptr), sz(0), capacity(0), curr(nullptr), curr_idx(0) {
+    try {
+      copyNodes(other);
+    } catch (...) {
+      freeNodes();
+      delete[] data;
+      throw;
+    }
+  }
+
+  /**
+   * Assignment operator. Builds the copy before releasing anything, so if
+   * copying throws, `this` is unchanged.
+   *
+   * Runs in O((N1+B1) + (N2+B2)).
+   */
+  StringHashMap& operator=(const StringHashMap& other) {
+    if (this == &other) {
+      return *this;
+    }
+    StringHashMap copy(other);
+    std::swap(data, copy.data);
+    std::swap(sz, copy.sz);
+    std::swap(capacity, copy.capacity);
+    curr = nullptr;
+    curr_idx = 0;
+    return *this;
+  }
+
+  /**
+   * Destructor. Runs in O(N+B).
+   */
+  ~StringHashMap() {
+    freeNodes();
+    delete[] data;
+  }
+
+  bool empty() const {
+    return sz == 0;
+  }
+
+  size_t size() const {
+    return sz;
+  }
+
+  size_t get_capacity() const {
+    return capacity;
+  }
+
+  /**
+   * Adds the mapping `{key -> value}` in a single allocation. If the key
+   * already exists, does not update the mapping.
+   *
+   * Runs in amortized O(L), where L is the length of the longest chain.
+   */
+  void insert(string_view key, const ValT& value) {
+    if (2 * (sz + 1) > 3 * capacity) {  // load factor > 1.5
+      rehash(capacity * 2);
+    }
+
+    size_t h = hashOf(key);
+    if (findNode(key, h) != nullptr) {
+      return;
+    }
+    size_t idx = h % capacity;
+    data[idx] = makeNode(key, h, value, data[idx]);
+    sz++;
+  }
+
+  /**
+   * Returns a reference to the value stored for `key`.
+   *
+   * If key is not present in the map, throw `out_of_range` exception.
+   *
+   * Runs in O(L), where L is the length of the longest chain.
+   */
+  ValT& at(string_view key) const {
+    ChainNode* node = findNode(key, hashOf(key));
+    if (node == nullptr) {
+      throw out_of_range("Key not found");
+    }
+    return node->value;
+  }
+
+  /**
+   * Returns `true` if the key is present in the map.
+   *
+   * Runs in O(L), where L is the length of the longest chain.
+   */
+  bool contains(string_view key) const {
+    return findNode(key, hashOf(key)) != nullptr;
+  }
+
+  /**
+   * Removes the mapping for `key` and returns its value.
+   *
+   * Throws `out_of_range` if the key is not present in the map.
+   *
+   * Runs in O(L), where L is the length of the longest chain.
+   */
+  ValT erase(string_view key) {
+    size_t h = hashOf(key);
+    ChainNode** link = &data[h % capacity];
+    while (*link != nullptr &&
+           !((*link)->hash == h && (*link)->key() == key)) {
+      link = &(*link)->next;
+    }
+    ChainNode* node = *link;
+    if (node == nullptr) {
+      throw out_of_range("Key not found");
+    }
+
+    *link = node->next;
+    ValT removedValue = std::move(node->value);
+    destroyNode(node);
+    sz--;
+    return removedValue;
+  }
+
+  /**
+   * Removes all mappings, keeping the bucket count.
+   *
+   * Runs in O(N+B).
+   */
+  void clear() {
+    freeNodes();
+    curr = nullptr;
+    curr_idx = 0;
+  }
+
+  /**
+   * Calls `fn(key, value)` for every mapping, with the key as a
+   * `string_view` into the node.
+   */
+  template <typename Fn>
+  void for_each(Fn fn) {
+    for (size_t i = 0; i < capacity; i++) {
+      for (ChainNode* n = data[i]; n != nullptr; n = n->next) {
+        fn(n->key(), n->value);
+      }
+    }
+  }
+
+  /**
+   * Resets internal state for an iterative traversal. See `HashMap::begin`.
+   *
+   * Runs in worst-case O(B).
+   */
+  void begin() {
+    curr_idx = 0;
+    while (curr_idx < capacity && data[curr_idx] == nullptr) {
+      curr_idx++;
+    }
+    curr = curr_idx < capacity ? data[curr_idx] : nullptr;
+  }
+
+  /**
+   * Sets `key` and `value` to the next mapping and returns `true`, or returns
+   * `false` once every mapping has been visited. See `HashMap::next`.
+   *
+   * Runs in worst-case O(B).
+   */
+  bool next(string& key, ValT& value) {
+    if (curr == nullptr) {
+      return false;
+    }
+    key.assign(curr->key());
+    value = curr->value;
+
+    if (curr->next != nullptr) {
+      curr = curr->next;
+      return true;
+    }
+    curr_idx++;
+    while (curr_idx < capacity && data[curr_idx] == nullptr) {
+      curr_idx++;
+    }
+    curr = curr_idx < capacity ? data[curr_idx] : nullptr;
+    return true;
+  }
+};
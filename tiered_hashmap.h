@@ -0,0 +1,543 @@
+#pragma once
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "hashmap.h"
+#include "hashmap_codec.h"
+
+using namespace std;
+
+struct TieredOptions {
+  // Spill file for cold pages. Created (truncated if present) on
+  // construction and removed on destruction; it does not survive restarts.
+  string path;
+
+  // Approximate memory for resident pages. Past it, the least recently used
+  // pages are written to the spill file and dropped from memory.
+  size_t memory_budget = size_t(256) << 20;
+
+  // Number of pages the key space is split into, rounded up to a power of
+  // two. More pages make evictions and faults finer-grained.
+  size_t pages = 4096;
+
+  // A fault reads at least this many bytes of the spill file, and also
+  // loads any other cold page whose record lies entirely within them.
+  size_t read_ahead_bytes = size_t(256) << 10;
+};
+
+struct TieredStats {
+  size_t resident_pages = 0;  // hot: held in memory
+  size_t cold_pages = 0;      // held only in the spill file
+  size_t resident_bytes = 0;  // estimated footprint of the resident pages
+  size_t file_bytes = 0;      // spill file size, including dead records
+  uint64_t hits = 0;          // operations whose page was resident
+  uint64_t faults = 0;        // operations that read their page from disk
+  uint64_t read_ahead = 0;    // pages loaded by read-ahead
+  uint64_t evictions = 0;
+  uint64_t bytes_read = 0;
+  uint64_t bytes_written = 0;
+};
+
+/**
+ * A hash map that can outgrow memory: its key space is split into pages,
+ * each holding a `HashMap` of the keys that hash to it, and pages beyond a
+ * memory budget are spilled to a local file.
+ *
+ * Eviction picks pages not used since the clock hand last passed them
+ * (second-chance LRU). An evicted page is written as one checksummed record
+ * of `Codec`-encoded mappings; a page that has not changed since it was last
+ * read is dropped without writing. Operations on a cold page read it back
+ * in, together with neighbouring cold pages that fit in the same read (see
+ * `TieredOptions::read_ahead_bytes`). The spill file is compacted once dead
+ * records make up more than half of it.
+ *
+ * The budget is checked against an estimate of each resident page: its
+ * nodes and buckets, plus the encoded size of its mappings when the key or
+ * value type owns heap memory. A single page larger than the budget stays
+ * resident while it is in use.
+ *
+ * Unlike `HashMap`, `at` returns a copy, since any later operation may evict
+ * the page holding the value, and every operation may do I/O and throw
+ * `system_error`. Not thread-safe.
+ */
+template <typename KeyT, typename ValT>
+class TieredHashMap {
+ private:
+  // Estimated memory per mapping: the `HashMap` node and the allocator's
+  // header for it.
+  static constexpr size_t kNodeBytes = sizeof(HashMapNode<KeyT, ValT>) + 16;
+  // Types that may own heap memory, estimated by their encoded size.
+  static constexpr bool kOwnsHeap =
+      !is_trivially_copyable_v<KeyT> || !is_trivially_copyable_v<ValT>;
+  // Dead space tolerated before the spill file is compacted.
+  static constexpr uint64_t kMinCompactBytes = uint64_t(1) << 20;
+
+  struct Page {
+    unique_ptr<HashMap<KeyT, ValT>> table;  // nullptr unless resident
+    size_t count = 0;                       // mappings, resident or not
+    size_t encodedBytes = 0;                // `Codec` size of the mappings
+    uint64_t diskOffset = 0;
+    uint32_t diskLength = 0;  // 0 if the file holds no current copy
+    bool referenced = false;  // used since the clock hand last passed
+  };
+
+  TieredOptions options;
+  int fd;
+  vector<Page> pages;
+  int pageBits;
+  size_t sz;
+  size_t residentBytes;
+  size_t residentPages;
+  size_t clockHand;
+  uint64_t fileEnd;
+  uint64_t liveDiskBytes;
+  // Cold pages by the offset of their record, for read-ahead
+  map<uint64_t, size_t> coldByOffset;
+  TieredStats counters;
+  string scratch;
+
+  // Helper functions
+
+  [[noreturn]] static void throwErrno(const string& what) {
+    throw system_error(errno, generic_category(), what);
+  }
+
+  static void writeAt(int fd, const char* p, size_t n, uint64_t offset) {
+    while (n > 0) {
+      ssize_t written = ::pwrite(fd, p, n, static_cast<off_t>(offset));
+      if (written < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        throwErrno("pwrite");
+      }
+      p += written;
+      n -= static_cast<size_t>(written);
+      offset += static_cast<uint64_t>(written);
+    }
+  }
+
+  static void readAt(int fd, char* p, size_t n, uint64_t offset) {
+    while (n > 0) {
+      ssize_t got = ::pread(fd, p, n, static_cast<off_t>(offset));
+      if (got < 0 && errno == EINTR) {
+        continue;
+      }
+      if (got < 0) {
+        throwErrno("pread");
+      }
+      if (got == 0) {
+        throw runtime_error("TieredHashMap: spill file truncated");
+      }
+      p += got;
+      n -= static_cast<size_t>(got);
+      offset += static_cast<uint64_t>(got);
+    }
+  }
+
+  size_t pageOf(const KeyT& key) const {
+    if (pageBits == 0) {
+      return 0;
+    }
+    // Top bits of a multiplicative mix, so a page's keys still spread over
+    // all of its own table's buckets.
+    uint64_t m = static_cast<uint64_t>(std::hash<KeyT>()(key)) *
+                 0x9E3779B97F4A7C15ull;
+    return static_cast<size_t>(m >> (64 - pageBits));
+  }
+
+  size_t encodedSize(const KeyT& key, const ValT& value) {
+    scratch.clear();
+    Codec<KeyT>::encode(key, scratch);
+    Codec<ValT>::encode(value, scratch);
+    return scratch.size();
+  }
+
+  static size_t footprint(const Page& p) {
+    if (p.table == nullptr) {
+      return 0;
+    }
+    return p.count * kNodeBytes + (kOwnsHeap ? p.encodedBytes : 0) +
+           p.table->get_capacity() * sizeof(void*);
+  }
+
+  // Forgets the page's disk copy, which no longer matches its contents.
+  void dropDiskCopy(Page& p) {
+    liveDiskBytes -= p.diskLength;
+    p.diskLength = 0;
+  }
+
+  // Rebuilds page `idx` from the record body at `payload`.
+  void load(size_t idx, const char* payload, size_t len) {
+    Page& p = pages[idx];
+    const char* q = payload;
+    const char* end = payload + len;
+    uint64_t count;
+    if (!Codec<uint64_t>::decode(q, end, count) || count != p.count) {
+      throw runtime_error("TieredHashMap: corrupt page record");
+    }
+
+    auto table = make_unique<HashMap<KeyT, ValT>>(
+        max<size_t>(10, (2 * count + 2) / 3));
+    KeyT key;
+    ValT value;
+    for (uint64_t i = 0; i < count; i++) {
+      if (!Codec<KeyT>::decode(q, end, key) ||
+          !Codec<ValT>::decode(q, end, value)) {
+        throw runtime_error("TieredHashMap: corrupt page record");
+      }
+      table->insert(key, value);
+    }
+
+    coldByOffset.erase(p.diskOffset);
+    p.table = std::move(table);
+    residentBytes += footprint(p);
+    residentPages++;
+  }
+
+  // Reads cold page `idx` back in, along with any other cold page whose
+  // record falls inside the same read.
+  void fault(size_t idx) {
+    Page& p = pages[idx];
+    uint64_t start = p.diskOffset;
+    size_t want = max<size_t>(p.diskLength, options.read_ahead_bytes);
+    size_t window = static_cast<size_t>(min<uint64_t>(want, fileEnd - start));
+    string buf(window, '\0');
+    readAt(fd, &buf[0], window, start);
+    counters.bytes_read += window;
+
+    const char* base = buf.data();
+    const char* end = base + window;
+    const char* cursor = base;
+    const char* payload;
+    size_t len;
+    if (!readFramed(cursor, end, payload, len)) {
+      throw runtime_error("TieredHashMap: corrupt page record");
+    }
+    load(idx, payload, len);
+
+    // Cold records after this one that were fully read
+    vector<pair<uint64_t, size_t>> neighbours(
+        coldByOffset.upper_bound(start),
+        coldByOffset.lower_bound(start + window));
+    for (const pair<uint64_t, size_t>& n : neighbours) {
+      const Page& other = pages[n.second];
+      if (n.first + other.diskLength > start + window) {
+        break;
+      }
+      cursor = base + (n.first - start);
+      if (readFramed(cursor, end, payload, len)) {
+        load(n.second, payload, len);
+        counters.read_ahead++;
+      }
+    }
+  }
+
+  // Makes page `idx` resident and marks it used.
+  void touch(size_t idx) {
+    Page& p = pages[idx];
+    if (p.table != nullptr) {
+      counters.hits++;
+    } else if (p.diskLength > 0) {
+      counters.faults++;
+      fault(idx);
+    } else {
+      // Never written out: empty, so nothing to read
+      counters.hits++;
+      p.table = make_unique<HashMap<KeyT, ValT>>();
+      residentBytes += footprint(p);
+      residentPages++;
+    }
+    p.referenced = true;
+  }
+
+  void evict(size_t idx) {
+    Page& p = pages[idx];
+    if (p.count > 0 && p.diskLength == 0) {
+      string record;
+      string body;
+      Codec<uint64_t>::encode(p.count, body);
+      body.reserve(p.encodedBytes + sizeof(uint64_t));
+      KeyT key;
+      ValT value;
+      p.table->begin();
+      while (p.table->next(key, value)) {
+        Codec<KeyT>::encode(key, body);
+        Codec<ValT>::encode(value, body);
+      }
+      appendFramed(record, body);
+      writeAt(fd, record.data(), record.size(), fileEnd);
+      counters.bytes_written += record.size();
+
+      p.diskOffset = fileEnd;
+      p.diskLength = static_cast<uint32_t>(record.size());
+      fileEnd += record.size();
+      liveDiskBytes += record.size();
+    }
+
+    residentBytes -= footprint(p);
+    p.table.reset();
+    residentPages--;
+    p.referenced = false;
+    if (p.count > 0) {
+      coldByOffset[p.diskOffset] = idx;
+    } else {
+      dropDiskCopy(p);
+    }
+    counters.evictions++;
+  }
+
+  // Evicts pages other than `pinned` (which is resident) until the resident
+  // pages fit the budget or `pinned` is the only one left, then compacts the
+  // spill file if it has become mostly dead. Each eviction takes at most two
+  // turns of the clock, the first clearing `referenced` bits.
+  void enforceBudget(size_t pinned) {
+    while (residentBytes > options.memory_budget && residentPages > 1) {
+      size_t idx = clockHand;
+      clockHand = (clockHand + 1) % pages.size();
+      Page& p = pages[idx];
+      if (idx == pinned || p.table == nullptr) {
+        continue;
+      }
+      if (p.referenced) {
+        p.referenced = false;
+      } else {
+        evict(idx);
+      }
+    }
+
+    if (fileEnd > kMinCompactBytes && fileEnd > 2 * liveDiskBytes) {
+      compact();
+    }
+  }
+
+  // Rewrites the current records into a fresh spill file, in file order.
+  void compact() {
+    string tmpPath = options.path + ".compact";
+    int newFd = ::open(tmpPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (newFd < 0) {
+      throwErrno("open " + tmpPath);
+    }
+
+    vector<pair<uint64_t, size_t>> live;
+    for (size_t i = 0; i < pages.size(); i++) {
+      if (pages[i].diskLength > 0) {
+        live.push_back({pages[i].diskOffset, i});
+      }
+    }
+    sort(live.begin(), live.end());
+
+    // Offsets are only updated once the new file has replaced the old one
+    vector<uint64_t> newOffsets;
+    uint64_t newEnd = 0;
+    try {
+      string buf;
+      for (const pair<uint64_t, size_t>& r : live) {
+        const Page& p = pages[r.second];
+        buf.resize(p.diskLength);
+        readAt(fd, &buf[0], p.diskLength, p.diskOffset);
+        writeAt(newFd, buf.data(), p.diskLength, newEnd);
+        counters.bytes_read += p.diskLength;
+        counters.bytes_written += p.diskLength;
+        newOffsets.push_back(newEnd);
+        newEnd += p.diskLength;
+      }
+      if (::rename(tmpPath.c_str(), options.path.c_str()) != 0) {
+        throwErrno("rename " + tmpPath);
+      }
+    } catch (...) {
+      ::close(newFd);
+      ::unlink(tmpPath.c_str());
+      throw;
+    }
+
+    ::close(fd);
+    fd = newFd;
+    fileEnd = newEnd;
+    coldByOffset.clear();
+    for (size_t i = 0; i < live.size(); i++) {
+      Page& p = pages[live[i].second];
+      p.diskOffset = newOffsets[i];
+      if (p.table == nullptr) {
+        coldByOffset[p.diskOffset] = live[i].second;
+      }
+    }
+  }
+
+ public:
+  /**
+   * Creates an empty map that spills to `options.path`.
+   *
+   * Throws `invalid_argument` if no path is given, and `system_error` if
+   * the file cannot be created.
+   */
+  explicit TieredHashMap(const TieredOptions& options)
+      : options(options),
+        fd(-1),
+        pageBits(0),
+        sz(0),
+        residentBytes(0),
+        residentPages(0),
+        clockHand(0),
+        fileEnd(0),
+        liveDiskBytes(0) {
+    if (options.path.empty()) {
+      throw invalid_argument("TieredHashMap needs a spill file path");
+    }
+    while ((size_t(1) << pageBits) < max<size_t>(options.pages, 1)) {
+      pageBits++;
+    }
+    pages.resize(size_t(1) << pageBits);
+
+    fd = ::open(options.path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+      throwErrno("open " + options.path);
+    }
+  }
+
+  TieredHashMap(const TieredHashMap&) = delete;
+  TieredHashMap& operator=(const TieredHashMap&) = delete;
+
+  /**
+   * Closes and removes the spill file.
+   */
+  ~TieredHashMap() {
+    ::close(fd);
+    ::unlink(options.path.c_str());
+  }
+
+  bool empty() const {
+    return sz == 0;
+  }
+
+  size_t size() const {
+    return sz;
+  }
+
+  /**
+   * Adds the mapping `{key -> value}`. If the key already exists, does not
+   * update the mapping. Reads the key's page in if it is cold, and may evict
+   * other pages afterwards.
+   *
+   * Runs in O(L) when the page is resident, plus one read when it is cold.
+   */
+  void insert(const KeyT& key, const ValT& value) {
+    size_t idx = pageOf(key);
+    touch(idx);
+    Page& p = pages[idx];
+    if (!p.table->contains(key)) {
+      residentBytes -= footprint(p);
+      p.table->insert(key, value);
+      p.count++;
+      p.encodedBytes += encodedSize(key, value);
+      residentBytes += footprint(p);
+      dropDiskCopy(p);
+      sz++;
+    }
+    enforceBudget(idx);
+  }
+
+  /**
+   * Returns a copy of the value stored for `key`, reading its page in if it
+   * is cold.
+   *
+   * If key is not present in the map, throw `out_of_range` exception.
+   *
+   * Runs in O(L) when the page is resident, plus one read when it is cold.
+   */
+  ValT at(const KeyT& key) {
+    size_t idx = pageOf(key);
+    touch(idx);
+    enforceBudget(idx);
+    return pages[idx].table->at(key);
+  }
+
+  /**
+   * Returns `true` if the key is present, reading its page in if it is
+   * cold.
+   *
+   * Runs in O(L) when the page is resident, plus one read when it is cold.
+   */
+  bool contains(const KeyT& key) {
+    size_t idx = pageOf(key);
+    touch(idx);
+    enforceBudget(idx);
+    return pages[idx].table->contains(key);
+  }
+
+  /**
+   * Removes the mapping for `key` and returns its value.
+   *
+   * Throws `out_of_range` if the key is not present in the map.
+   *
+   * Runs in O(L) when the page is resident, plus one read when it is cold.
+   */
+  ValT erase(const KeyT& key) {
+    size_t idx = pageOf(key);
+    touch(idx);
+    enforceBudget(idx);
+    Page& p = pages[idx];
+    size_t before = footprint(p);
+    ValT removedValue = p.table->erase(key);  // may throw out_of_range
+    p.count--;
+    p.encodedBytes -= encodedSize(key, removedValue);
+    residentBytes = residentBytes - before + footprint(p);
+    dropDiskCopy(p);
+    sz--;
+    return removedValue;
+  }
+
+  /**
+   * Removes all mappings and empties the spill file. Statistics counters
+   * are kept.
+   *
+   * Runs in O(N + P), where P is the number of pages.
+   */
+  void clear() {
+    for (Page& p : pages) {
+      p = Page();
+    }
+    coldByOffset.clear();
+    if (::ftruncate(fd, 0) != 0) {
+      throwErrno("ftruncate");
+    }
+    sz = 0;
+    residentBytes = 0;
+    residentPages = 0;
+    fileEnd = 0;
+    liveDiskBytes = 0;
+  }
+
+  /**
+   * Returns hot/cold page counts, memory and file sizes, and cumulative
+   * hit, fault, read-ahead, eviction and I/O counters.
+   *
+   * Runs in O(P), where P is the number of pages.
+   */
+  TieredStats stats() const {
+    TieredStats s = counters;
+    for (const Page& p : pages) {
+      if (p.table != nullptr) {
+        s.resident_pages++;
+      } else if (p.count > 0) {
+        s.cold_pages++;
+      }
+    }
+    s.resident_bytes = residentBytes;
+    s.file_bytes = fileEnd;
+    return s;
+  }
+};